@@ -5,6 +5,9 @@
 #include <dlib/image_io.h>
 #include <dlib/dir_nav.h>
 #include <dlib/opencv.h>
+#include <dlib/optimization/max_cost_assignment.h>
+
+#include "thread_pool.hpp"
 
 /* ==========================================================================
 
@@ -29,26 +32,6 @@ public:
 	}
 
 
-	/* -------------------------------------------------
-	Function : cvtMatToArray2d
-	convert cv::Mat to dlib::array2d<unsigned char>
-	------------------------------------------------- */
-	static dlib::array2d<unsigned char> cvtMatToArray2d(cv::Mat _mat) // cv::Mat, not cv::Mat&. Make sure use copy of image, not the original one when converting to grayscale
-	{
-
-		//Don't need to use color image in HOG-feature-based tracker
-		//Convert color image to grayscale
-		if (_mat.channels() == 3)
-			cv::cvtColor(_mat, _mat, cv::COLOR_RGB2GRAY);
-
-		//Convert opencv 'MAT' to dlib 'array2d<unsigned char>'
-		dlib::array2d<unsigned char> dlib_img;
-		dlib::assign_image(dlib_img, dlib::cv_image<unsigned char>(_mat));
-
-		return dlib_img;
-	}
-
-
 	/* -----------------------------------------------------------------
 	Function : setRectToImage
 	Put all tracking results(new rectangle) on the frame image
@@ -66,23 +49,95 @@ public:
 
 /* ---------------------------------------------------------------------------------
 
+Function : update
+
+Convert the frame to grayscale. HOG-feature-based tracker doesn't need the color
+image. cv::cvtColor reuses the buffer as long as the frame size doesn't change.
+
+---------------------------------------------------------------------------------*/
+void FrameImageCache::update(const cv::Mat& _mat_img)
+{
+	if (_mat_img.channels() == 3)
+		cv::cvtColor(_mat_img, this->gray, cv::COLOR_BGR2GRAY);
+	else
+		this->gray = _mat_img;
+}
+
+/* ---------------------------------------------------------------------------------
+
+Function : initMotionModel
+
+Constant velocity Kalman filter on the center of the target, one step per frame.
+The process noise is a random acceleration of about 1 pixel per frame^2 and the
+measurement noise about 2 pixels, the jitter of the correlation tracker peak.
+The first measurement sets the position with zero velocity, the velocity being
+unknown until the second one.
+
+---------------------------------------------------------------------------------*/
+void SingleTracker::initMotionModel()
+{
+	const double accel_var = 1.0;
+	const double meas_var = 4.0;
+
+	dlib::matrix<double, 4, 4> A;
+	A = 1, 0, 1, 0,
+	    0, 1, 0, 1,
+	    0, 0, 1, 0,
+	    0, 0, 0, 1;
+	dlib::matrix<double, 2, 4> H;
+	H = 1, 0, 0, 0,
+	    0, 1, 0, 0;
+	// Discrete white noise acceleration, dt = 1 frame
+	dlib::matrix<double, 4, 4> Q;
+	Q = 0.25, 0,    0.5, 0,
+	    0,    0.25, 0,   0.5,
+	    0.5,  0,    1,   0,
+	    0,    0.5,  0,   1;
+	dlib::matrix<double, 4, 4> P;
+	P = 10, 0,  0,   0,
+	    0,  10, 0,   0,
+	    0,  0,  100, 0,
+	    0,  0,  0,   100;
+
+	this->motion.set_transition_model(A);
+	this->motion.set_observation_model(H);
+	this->motion.set_process_noise(accel_var * Q);
+	this->motion.set_measurement_noise(meas_var * dlib::identity_matrix<double>(2));
+	this->motion.set_estimation_error_covariance(P);
+}
+
+/* ---------------------------------------------------------------------------------
+
 Function : calcVel
 
-Calculate velocity as an average of last n_frames frames (dX, dY).
+Feed the current center to the motion model and take its velocity, scaled to
+vel_frames frames, as the velocity vector.
 
 ---------------------------------------------------------------------------------*/
 void SingleTracker::calcVel()
 {
-	double delta_x = 0;
-	double delta_y = 0;
-	cv::Point avgvel;
+	dlib::matrix<double, 2, 1> z;
+	z = this->getCenter().x, this->getCenter().y;
+	this->motion.update(z);
 
-	if (this->c_q.size() >= 5) {
-		delta_x = (this->c_q[4].x - this->c_q[0].x)*5;
-		delta_y = (this->c_q[4].y - this->c_q[0].y)*5;
-	}
-	avgvel = ((this->getVel() - this->getCenter()) + cv::Point(std::round(delta_x),std::round(delta_y)))/2;
-	this->setVel(this->getCenter() + avgvel);
+	const cv::Point2d v = this->getMotionVel();
+	this->setVel(this->getCenter() + cv::Point(std::round(v.x * vel_frames), std::round(v.y * vel_frames)));
+}
+
+cv::Point2d SingleTracker::getMotionVel() const
+{
+	const dlib::matrix<double, 4, 1>& x = this->motion.get_current_state();
+	return cv::Point2d(x(2), x(3));
+}
+
+dlib::drectangle SingleTracker::predictPosition() const
+{
+	// No measurement yet
+	if (this->c_q.empty())
+		return this->position;
+
+	const dlib::matrix<double, 4, 1>& xb = this->motion.get_predicted_next_state();
+	return dlib::translate_rect(this->position, dlib::dpoint(xb(0), xb(1)) - dlib::center(this->position));
 }
 
 /* ---------------------------------------------------------------------------------
@@ -92,32 +147,108 @@ Function : startSingleTracking
 Initialize dlib::correlation_tracker tracker using dlib::start_track function
 
 ---------------------------------------------------------------------------------*/
-int SingleTracker::startSingleTracking(cv::Mat _mat_img)
+int SingleTracker::startSingleTracking(const FrameImageCache::view_type& _img)
 {
 	// Exception
-	if (_mat_img.empty())
+	if (_img.size() == 0)
 	{
 		std::cout << "====================== Error Occured! =======================" << std::endl;
 		std::cout << "Function : int SingleTracker::startSingleTracking" << std::endl;
-		std::cout << "Parameter cv::Mat& _mat_img is empty image!" << std::endl;
+		std::cout << "Parameter _img is empty image!" << std::endl;
 		std::cout << "=============================================================" << std::endl;
 
 		return FAIL;
 	}
 
-	// Convert _mat_img to dlib::array2d<unsigned char>
-	dlib::array2d<unsigned char> dlib_frame = Util::cvtMatToArray2d(_mat_img);
-
 	// Convert SingleTracker::rect to dlib::drectangle
-	dlib::drectangle dlib_rect = Util::cvtRectToDrect(this->getRect());
+	this->position = Util::cvtRectToDrect(this->getRect());
 
 	// Initialize SingleTracker::tracker
-	this->tracker.start_track(dlib_frame, dlib_rect);
+	this->startTrack(_img, this->position);
+	this->setIsTrackingStarted(true);
+
+	return SUCCESS;
+}
+
+// ROI variant of startSingleTracking
+int SingleTracker::startSingleTrackingROI(const cv::Mat& _mat_img)
+{
+	// Exception
+	if (_mat_img.empty())
+	{
+		std::cout << "====================== Error Occured! =======================" << std::endl;
+		std::cout << "Function : int SingleTracker::startSingleTrackingROI" << std::endl;
+		std::cout << "Parameter cv::Mat& _mat_img is empty image!" << std::endl;
+		std::cout << "=============================================================" << std::endl;
+
+		return FAIL;
+	}
+
+	this->position = Util::cvtRectToDrect(this->getRect());
+	SearchWindow window = this->extractSearchWindow(_mat_img);
+	this->startTrack(FrameImageCache::view_type(this->window_img), window.toWindow(this->position));
 	this->setIsTrackingStarted(true);
 
 	return SUCCESS;
 }
 
+/* ---------------------------------------------------------------------------------
+
+Function : extractSearchWindow
+
+correlation_tracker only looks at the target box padded by 1.4 around the guess.
+Crop that area, widened to where the last displacement would take the target,
+convert it to grayscale and downscale it when it holds much more detail than
+the filter_size x filter_size chip the tracker resamples it to.
+
+---------------------------------------------------------------------------------*/
+SearchWindow SingleTracker::extractSearchWindow(const cv::Mat& _mat_img)
+{
+	const double padding = 1.4;		// Same padding as correlation_tracker::make_chip
+	const int border = 2;			// Room for the bilinear interpolation
+	const double min_oversampling = 2.0;	// Keep at least 2 window pixels per chip pixel
+
+	// Last displacement of the target
+	cv::Point2d shift(0, 0);
+	if (this->c_q.size() >= 2)
+		shift = cv::Point2d(this->c_q[this->c_q.size() - 1] - this->c_q[this->c_q.size() - 2]);
+
+	const double half_w = this->position.width() * padding / 2;
+	const double half_h = this->position.height() * padding / 2;
+	const dlib::dpoint c = dlib::center(this->position);
+
+	int left = static_cast<int>(std::floor(c.x() - half_w + std::min(0.0, shift.x))) - border;
+	int top = static_cast<int>(std::floor(c.y() - half_h + std::min(0.0, shift.y))) - border;
+	int right = static_cast<int>(std::ceil(c.x() + half_w + std::max(0.0, shift.x))) + border;
+	int bottom = static_cast<int>(std::ceil(c.y() + half_h + std::max(0.0, shift.y))) + border;
+
+	left = std::max(0, std::min(left, _mat_img.cols - 1));
+	top = std::max(0, std::min(top, _mat_img.rows - 1));
+	right = std::max(left + 1, std::min(right, _mat_img.cols));
+	bottom = std::max(top + 1, std::min(bottom, _mat_img.rows));
+	const cv::Rect roi(left, top, right - left, bottom - top);
+
+	SearchWindow window;
+	window.origin = cv::Point2d(left, top);
+	const double chip_side = padding * std::max(this->position.width(), this->position.height());
+	window.scale = std::min(1.0, min_oversampling * this->tracker.get_filter_size() / chip_side);
+
+	const cv::Mat roi_img = _mat_img(roi);
+	if (window.scale < 1.0) {
+		if (roi_img.channels() == 3)
+			cv::cvtColor(roi_img, this->window_gray, cv::COLOR_BGR2GRAY);
+		else
+			this->window_gray = roi_img;
+		cv::resize(this->window_gray, this->window_img, cv::Size(), window.scale, window.scale, cv::INTER_AREA);
+	} else if (roi_img.channels() == 3) {
+		cv::cvtColor(roi_img, this->window_img, cv::COLOR_BGR2GRAY);
+	} else {
+		this->window_img = roi_img;
+	}
+
+	return window;
+}
+
 /*---------------------------------------------------------------------------------
 
 Function : isTargetInsideFrame
@@ -142,23 +273,62 @@ int SingleTracker::isTargetInsideFrame(int _frame_width, int _frame_height)
 
 /* -----------------------------------------------------------------------------------
 
-Function : markForDeletion(std::vector<std::pair<cv::Rect, int>> rois)
+Function : markForDeletion()
 
-Mark trackers to delete.
+Mark trackers to delete, once the state machine gave up on them (see TrackLifecycle).
 
 ----------------------------------------------------------------------------------- */
 
 int SingleTracker::markForDeletion()
 {
-	const int frames = 12; // Arbitrary numbers, adjust if needed
-	const double min_vel = 0.01*this->rect.area();
-
-	if (this->no_update_counter >= frames && this->modvel < min_vel)
+	if (this->state == DELETED)
 		this->to_delete = true;
 
 	return SUCCESS;
 }
 
+/* -----------------------------------------------------------------------------------
+
+Function : detectionHit / detectionMissed
+
+Move the track through its states on the key frames: every detection assigned to
+it is a hit, every key frame without one a miss.
+
+----------------------------------------------------------------------------------- */
+void SingleTracker::detectionHit()
+{
+	this->hits++;
+	this->misses = 0;
+	this->low_psr_count = 0;
+	if (this->state == LOST)
+	{
+		this->state = CONFIRMED;
+		this->reacquired = true;
+	}
+	else if (this->state == TENTATIVE && this->hits >= this->lifecycle.confirm_hits)
+	{
+		this->state = CONFIRMED;
+	}
+}
+
+void SingleTracker::detectionMissed()
+{
+	this->misses++;
+	if (this->state == TENTATIVE && this->misses >= this->lifecycle.tentative_misses)
+		this->state = DELETED;
+	else if (this->state == CONFIRMED && this->misses >= this->lifecycle.confirmed_misses)
+		this->loseTrack();
+	this->markForDeletion();
+}
+
+void SingleTracker::loseTrack()
+{
+	this->state = LOST;
+	this->lost_frames = 0;
+	this->low_psr_count = 0;
+	this->misses = 0;
+}
+
 /* ---------------------------------------------------------------------------------
 
 Function : doSingleTracking
@@ -169,33 +339,148 @@ SingleTracker::rect is initialized to the target position in the constructor of
 Using correlation_tracker in dlib, start tracking 'one' target
 
 --------------------------------------------------------------------------------- */
-int SingleTracker::doSingleTracking(cv::Mat _mat_img)
+int SingleTracker::doSingleTracking(const FrameImageCache::view_type& _img)
 {
 	//Exception
-	if (_mat_img.empty())
+	if (_img.size() == 0)
 	{
 		std::cout << "====================== Error Occured! ======================= " << std::endl;
 		std::cout << "Function : int SingleTracker::doSingleTracking" << std::endl;
+		std::cout << "Parameter _img is empty image!" << std::endl;
+		std::cout << "=============================================================" << std::endl;
+
+		return FAIL;
+	}
+
+	return this->trackInWindow(_img, SearchWindow());
+}
+
+// ROI variant of doSingleTracking
+int SingleTracker::doSingleTrackingROI(const cv::Mat& _mat_img)
+{
+	//Exception
+	if (_mat_img.empty())
+	{
+		std::cout << "====================== Error Occured! ======================= " << std::endl;
+		std::cout << "Function : int SingleTracker::doSingleTrackingROI" << std::endl;
 		std::cout << "Parameter cv::Mat& _mat_img is empty image!" << std::endl;
 		std::cout << "=============================================================" << std::endl;
 
 		return FAIL;
 	}
 
-	// Convert _mat_img to dlib::array2d<unsigned char>
-	dlib::array2d<unsigned char> dlib_img = Util::cvtMatToArray2d(_mat_img);
+	// A new detection moves the window to the detected box, otherwise it goes where the target is expected
+	if (this->getUpdateFromDetection())
+		this->position = Util::cvtRectToDrect(this->getRect());
+	else
+		this->position = this->predictPosition();
+
+	SearchWindow window = this->extractSearchWindow(_mat_img);
+	return this->trackInWindow(FrameImageCache::view_type(this->window_img), window);
+}
+
+void SingleTracker::startTrack(const FrameImageCache::view_type& _img, const dlib::drectangle& _drect)
+{
+	if (this->float_precision)
+		this->tracker_float.start_track(_img, _drect);
+	else
+		this->tracker.start_track(_img, _drect);
+
+	// The box comes from a detection, the scale schedule starts over
+	this->frames_since_scale = 0;
+	this->mean_psr = 0;
+	this->scale_changing = false;
+}
+
+double SingleTracker::updateTrack(const FrameImageCache::view_type& _img, const dlib::drectangle& _guess)
+{
+	if (this->float_precision)
+		return this->tracker_float.update_noscale(_img, _guess);
+	return this->tracker.update_noscale(_img, _guess);
+}
+
+void SingleTracker::updateTrackScale(const FrameImageCache::view_type& _img)
+{
+	const double area = this->getTrackerPosition().area();
+	if (this->float_precision)
+		this->tracker_float.update_scale(_img);
+	else
+		this->tracker.update_scale(_img);
+
+	this->frames_since_scale = 0;
+	this->scale_changing = std::abs(this->getTrackerPosition().area() / area - 1) > this->scale_schedule.area_rate;
+}
+
+/* ---------------------------------------------------------------------------------
+
+Function : needsScaleUpdate
+
+Scale schedule of the target. In ADAPTIVE mode the scale is estimated when the
+PSR falls well below its running mean (the box may no longer fit the target),
+while the last estimation found the target growing or shrinking, and at least
+every interval frames.
+
+--------------------------------------------------------------------------------- */
+bool SingleTracker::needsScaleUpdate(double _psr)
+{
+	switch (this->scale_schedule.mode)
+	{
+	case ScaleSchedule::NEVER:
+		return false;
+	case ScaleSchedule::ALWAYS:
+		return true;
+	default:
+		break;
+	}
+
+	this->frames_since_scale++;
+	const bool psr_dropped = this->mean_psr > 0 && _psr < this->scale_schedule.psr_drop * this->mean_psr;
+	this->mean_psr = (this->mean_psr > 0) ? 0.9 * this->mean_psr + 0.1 * _psr : _psr;
+
+	return psr_dropped || this->scale_changing || this->frames_since_scale >= this->scale_schedule.interval;
+}
+
+dlib::drectangle SingleTracker::getTrackerPosition() const
+{
+	return this->float_precision ? this->tracker_float.get_position() : this->tracker.get_position();
+}
+
+/* ---------------------------------------------------------------------------------
 
+Function : trackInWindow
+
+Core of doSingleTracking. The correlation tracker only ever sees window
+coordinates, the target position is kept in frame coordinates.
+
+--------------------------------------------------------------------------------- */
+int SingleTracker::trackInWindow(const FrameImageCache::view_type& _img, const SearchWindow& _window)
+{
 	// Track using dlib::update function
+	double confidence = this->getConfidence();
 	if (this->getUpdateFromDetection()) {
-		dlib::drectangle dlib_rect = Util::cvtRectToDrect(this->getRect());
-		this->tracker.start_track(dlib_img, dlib_rect);
+		this->position = Util::cvtRectToDrect(this->getRect());
+		if (this->reacquired) {
+			// The filter of the lost target still knows it, search around the detection
+			confidence = this->updateTrack(_img, _window.toWindow(this->position));
+			this->correlationDone(confidence);
+			this->reacquired = false;
+		} else {
+			this->startTrack(_img, _window.toWindow(this->position));
+			this->coast_frames = 0;
+		}
 		this->setUpdateFromDetection(false);
 	} else {
-		double confidence = this->tracker.update_noscale(dlib_img);
+		// Search around the predicted position, fast targets stay inside the filter window
+		this->position = this->predictPosition();
+		confidence = this->updateTrack(_img, _window.toWindow(this->position));
+		if (this->needsScaleUpdate(confidence))
+			this->updateTrackScale(_img);
+		this->correlationDone(confidence);
 	}
 
 	// New position of the target
-	dlib::drectangle updated_rect = this->tracker.get_position();
+	this->position = _window.toFrame(this->getTrackerPosition());
+	dlib::drectangle updated_rect = this->position;
 
 	// Update variables(center, rect, confidence)
 	this->setCenter(updated_rect);
@@ -208,6 +493,147 @@ int SingleTracker::doSingleTracking(cv::Mat _mat_img)
 	return SUCCESS;
 }
 
+/* ---------------------------------------------------------------------------------
+
+Function : prepareBatchTracking / doBatchTracking
+
+Batch mode counterpart of doSingleTracking. The correlation filter of the target
+lives in a slot of the BatchCorrelationTracker, which tracks all targets at once
+between these two calls.
+
+--------------------------------------------------------------------------------- */
+void SingleTracker::prepareBatchTracking(BatchCorrelationTracker& _batch)
+{
+	this->coasting = false;
+	this->batch_started = false;
+	if (this->batch_slot < 0)
+	{
+		this->batch_slot = _batch.allocate();
+		this->position = Util::cvtRectToDrect(this->getRect());
+		_batch.start(this->batch_slot, this->position);
+		this->setIsTrackingStarted(true);
+		this->batch_started = true;
+	}
+	else if (this->getUpdateFromDetection())
+	{
+		this->position = Util::cvtRectToDrect(this->getRect());
+		if (this->reacquired)
+		{
+			// The filter of the lost target still knows it, search around the detection
+			_batch.setGuess(this->batch_slot, this->position);
+			this->reacquired = false;
+		}
+		else
+		{
+			_batch.start(this->batch_slot, this->position);
+			this->batch_started = true;
+		}
+		this->setUpdateFromDetection(false);
+		this->coast_frames = 0;
+	}
+	else if (this->shouldCoast())
+	{
+		_batch.hold(this->batch_slot);
+		this->coasting = true;
+	}
+	else
+	{
+		_batch.setGuess(this->batch_slot, this->predictPosition());
+	}
+}
+
+int SingleTracker::doBatchTracking(const BatchCorrelationTracker& _batch)
+{
+	if (this->batch_slot < 0)
+		return FAIL;
+	if (this->coasting)
+		return this->coastSingleTracking();
+
+	// New position of the target
+	this->position = _batch.getPosition(this->batch_slot);
+
+	// Update variables(center, rect, confidence)
+	this->setCenter(this->position);
+	this->setRect(this->position);
+	this->setConfidence(_batch.getPSR(this->batch_slot));
+	if (!this->batch_started)
+		this->correlationDone(this->getConfidence());
+	this->saveLastCenter(this->getCenter());
+	this->calcVel();
+	this->no_update_counter++;
+	this->markForDeletion();
+	return SUCCESS;
+}
+
+/* ---------------------------------------------------------------------------------
+
+Function : shouldCoast / coastSingleTracking
+
+Decide from the CoastPolicy whether the target skips the correlation update this
+frame and, if so, move it with the motion model alone: the filter prediction
+becomes the new position without any measurement, so the velocity is kept and
+the uncertainty grows until the next correlation update.
+A new detection and the first frames, before the motion model has a velocity,
+always go through the correlation tracker.
+
+---------------------------------------------------------------------------------*/
+bool SingleTracker::shouldCoast()
+{
+	// A lost target only moves with its motion model, until a detection finds it
+	if (this->state == LOST)
+		return !this->getUpdateFromDetection();
+	if (this->coast_policy.interval <= 0 || !this->getIsTrackingStarted() || this->getUpdateFromDetection())
+		return false;
+	if (this->c_q.size() < 2 || this->coast_frames >= this->coast_policy.interval)
+		return false;
+
+	const cv::Point2d v = this->getMotionVel();
+	const bool small = std::max(this->rect.width, this->rect.height) < this->coast_policy.min_side;
+	const bool slow = std::sqrt(v.x * v.x + v.y * v.y) < this->coast_policy.max_speed;
+	const bool stable = this->stable_count >= this->coast_policy.stable_updates;
+	return small || slow || stable;
+}
+
+int SingleTracker::coastSingleTracking()
+{
+	this->motion.update();
+	const dlib::matrix<double, 4, 1>& x = this->motion.get_current_state();
+	this->position = dlib::translate_rect(this->position, dlib::dpoint(x(0), x(1)) - dlib::center(this->position));
+
+	// Update variables(center, rect), the confidence is the one of the last correlation update
+	this->setCenter(this->position);
+	this->setRect(this->position);
+	this->saveLastCenter(this->getCenter());
+	const cv::Point2d v = this->getMotionVel();
+	this->setVel(this->getCenter() + cv::Point(std::round(v.x * vel_frames), std::round(v.y * vel_frames)));
+	this->coast_frames++;
+	this->no_update_counter++;
+	if (this->state == LOST && ++this->lost_frames > this->lifecycle.max_lost_frames)
+		this->state = DELETED;
+	this->markForDeletion();
+	return SUCCESS;
+}
+
+void SingleTracker::correlationDone(double _psr)
+{
+	this->coast_frames = 0;
+	this->stable_count = (_psr >= this->coast_policy.stable_psr) ? this->stable_count + 1 : 0;
+
+	// Failures only clear above high_psr, between both thresholds they stay
+	if (_psr < this->lifecycle.low_psr)
+		this->low_psr_count++;
+	else if (_psr >= this->lifecycle.high_psr)
+		this->low_psr_count = 0;
+
+	if (this->low_psr_count >= this->lifecycle.low_psr_frames)
+	{
+		if (this->state == TENTATIVE)
+			this->state = DELETED;
+		else if (this->state == CONFIRMED)
+			this->loseTrack();
+	}
+}
+
 /* -------------------------------------------------------------------------
 
 Function : insertTracker
@@ -250,6 +676,7 @@ int TrackerManager::insertTracker(cv::Rect _init_rect, cv::Scalar _color, int _t
 			this->tracker_vec[result_idx]->setNoUpdateCounter(0);
 			this->tracker_vec[result_idx]->setLabel(_label);
 			this->tracker_vec[result_idx]->setColor(_color);
+			this->tracker_vec[result_idx]->detectionHit();
 		}
 	} else {
 		this->tracker_vec.push_back(new_tracker);
@@ -263,6 +690,7 @@ int TrackerManager::insertTracker(cv::Rect _init_rect, cv::Scalar _color, int _t
 		*last_event = aux_str.str();
 	}
 
+	this->invalidateGrid();
 	return SUCCESS;
 }
 
@@ -295,6 +723,7 @@ int TrackerManager::insertTracker(std::shared_ptr<SingleTracker> new_single_trac
 			this->tracker_vec[result_idx]->setRect(new_single_tracker->getRect());
 			this->tracker_vec[result_idx]->setUpdateFromDetection(update);
 			this->tracker_vec[result_idx]->setNoUpdateCounter(0);
+			this->tracker_vec[result_idx]->detectionHit();
 		}
 	} else {
 		// Insert new SingleTracker object into the vector
@@ -303,6 +732,7 @@ int TrackerManager::insertTracker(std::shared_ptr<SingleTracker> new_single_trac
 
 	}
 
+	this->invalidateGrid();
 	return SUCCESS;
 }
 
@@ -328,61 +758,126 @@ int TrackerManager::findTrackerByID(int _target_id)
 
 /* -----------------------------------------------------------------------------------
 
-Function : findTracker
+Function : assignDetections
 
-Find SingleTracker object in the TrackerManager::tracker_vec
-If success to find return that index, or return new index if no coincidence
+Match the detections of a frame to the trackers in the TrackerManager::tracker_vec.
+A detection may go to a tracker of the same (or unknown) label when their boxes
+overlap by more than 90% of the smaller one and their centers are close. Among
+those pairs, the assignment with the best total IoU and center distance is
+solved with dlib::max_cost_assignment, so no tracker gets two detections.
+Only the trackers sharing a grid cell with a detection are compared to it.
+
+A detection without a tracker gets a new id when it overlaps no active tracker
+nor any earlier new detection, and -1 otherwise.
 
 ----------------------------------------------------------------------------------- */
-int TrackerManager::findTracker(cv::Rect rect, int label)
-{
-	double max_overlap_thresh = 0.9;
-	double dist_thresh = rect.height*rect.width>>1; // Pixels^2 -> adjust properly (maybe a proportion of the img size?)
-	std::vector<std::shared_ptr<SingleTracker>> selection;
-	std::shared_ptr<SingleTracker> best = NULL;
-	double min_distance = (rect.height*rect.width)+10; // Init bigger than threshold
-	int index;
-	bool new_object = true;
-	std::vector<double> areas;
-
-	for(auto && s_tracker: this->getTrackerVec()) {
-		double in_area = (s_tracker.get()->getRect() & rect).area();
-		double max_per_area = std::max(in_area / s_tracker.get()->getRect().area(), in_area/rect.area());
-		areas.push_back(max_per_area);
-		if ( max_per_area > max_overlap_thresh && (s_tracker->getLabel() == label || s_tracker->getLabel() == LABEL_UNKNOWN) ) {
-			selection.push_back(s_tracker);
-		}
-	}
+std::vector<int> TrackerManager::assignDetections(const std::vector<std::pair<cv::Rect, int>>& _detections)
+{
+	const double max_overlap_thresh = 0.9;
+	const long score_scale = 1000; // The solver needs integer scores
+
+	std::vector<int> ids(_detections.size(), -1);
+	if (_detections.empty())
+		return ids;
+
+	// Candidate pairs, and the rows and columns of the detections and trackers having some
+	struct Candidate { int row; int col; long score; };
+	std::vector<Candidate> candidates;
+	std::vector<int> row_of_det(_detections.size(), -1), det_of_row;
+	std::vector<int> col_of_trk(this->tracker_vec.size(), -1), trk_of_col;
+	std::vector<bool> overlaps(_detections.size(), false);
+	std::vector<int> near;
+
+	for (size_t d = 0; d < _detections.size(); d++)
+	{
+		const cv::Rect& rect = _detections[d].first;
+		const int label = _detections[d].second;
+		const double dist_thresh = rect.height*rect.width>>1; // Pixels^2 -> adjust properly (maybe a proportion of the img size?)
+		const cv::Point n_center = cv::Point(rect.x + (rect.width) / 2, rect.y + (rect.height) / 2);
 
-	for (auto && s_tracker: selection) {
-		cv::Point n_center = cv::Point(rect.x + (rect.width) / 2, rect.y + (rect.height) / 2);
-		cv::Point diff = s_tracker.get()->getCenter() - n_center;
-		double distance = diff.x*diff.x + diff.y*diff.y;
-		if (best == NULL && distance < dist_thresh) {
-			min_distance = distance;
-			best = s_tracker;
-		} else if ( best != NULL && distance < min_distance ) {
-			min_distance = distance;
-			best = s_tracker;
+		this->findTrackersNear(rect, near);
+		for (auto && t : near)
+		{
+			const std::shared_ptr<SingleTracker>& s_tracker = this->tracker_vec[t];
+			const cv::Rect t_rect = s_tracker->getRect();
+			const double in_area = (t_rect & rect).area();
+			if (in_area == 0)
+				continue;
+			// A lost tracker is only a guess of where its target went, it may take
+			// the detection but does not keep it from starting a new track
+			if (s_tracker->isActive())
+				overlaps[d] = true;
+
+			const double max_per_area = std::max(in_area / t_rect.area(), in_area / rect.area());
+			if (max_per_area <= max_overlap_thresh || (s_tracker->getLabel() != label && s_tracker->getLabel() != LABEL_UNKNOWN))
+				continue;
+			const cv::Point diff = s_tracker->getCenter() - n_center;
+			const double distance = diff.x*diff.x + diff.y*diff.y;
+			if (distance >= dist_thresh)
+				continue;
+
+			if (row_of_det[d] == -1)
+			{
+				row_of_det[d] = static_cast<int>(det_of_row.size());
+				det_of_row.push_back(static_cast<int>(d));
+			}
+			if (col_of_trk[t] == -1)
+			{
+				col_of_trk[t] = static_cast<int>(trk_of_col.size());
+				trk_of_col.push_back(t);
+			}
+			const double iou = in_area / (t_rect.area() + rect.area() - in_area);
+			const double score = iou + (1 - distance / dist_thresh); // Both in [0, 1]
+			// Every candidate scores above 0, the padding of the square matrix
+			candidates.push_back({ row_of_det[d], col_of_trk[t], 1 + std::lround(score * score_scale) });
 		}
 	}
 
-	for (auto && area: areas) {
-		if (area != 0.0) {
-			new_object = false;
-			break;
+	// Solve on the detections and trackers having candidates only
+	if (!candidates.empty())
+	{
+		const long n = std::max(det_of_row.size(), trk_of_col.size());
+		dlib::matrix<long> score(n, n);
+		score = 0;
+		for (auto && c : candidates)
+			score(c.row, c.col) = c.score;
+
+		const std::vector<long> assignment = dlib::max_cost_assignment(score);
+		for (size_t row = 0; row < det_of_row.size(); row++)
+		{
+			const long col = assignment[row];
+			if (score(row, col) > 0)
+				ids[det_of_row[row]] = this->tracker_vec[trk_of_col[col]]->getTargetID();
 		}
 	}
 
-	if ( best == NULL && new_object ) {
-		index = this->getNextID();
-	} else if ( best != NULL ) {
-		index = best.get()->getTargetID();
-	} else if (!new_object) {
-		index = -1;
+	// New targets, a detection overlapping another new one is a duplicate
+	SpatialGrid fresh(this->getGridCellSize());
+	int next_id = this->getNextID();
+	for (size_t d = 0; d < _detections.size(); d++)
+	{
+		if (ids[d] != -1 || overlaps[d])
+			continue;
+
+		const cv::Rect& rect = _detections[d].first;
+		bool duplicate = false;
+		fresh.query(rect, near);
+		for (auto && other : near)
+		{
+			if ((_detections[other].first & rect).area() > 0)
+			{
+				duplicate = true;
+				break;
+			}
+		}
+		if (!duplicate)
+		{
+			ids[d] = next_id++;
+			fresh.insert(static_cast<int>(d), rect);
+		}
 	}
 
-	return index;
+	return ids;
 }
 
 /* -----------------------------------------------------------------------------------
@@ -407,11 +902,15 @@ int TrackerManager::deleteTracker(int _target_id, std::string *last_event)
 	}
 	else
 	{
+		// Give the filter slot back to the arena
+		this->batch_tracker.release(this->tracker_vec[result_idx]->getBatchSlot());
+
 		// Memory deallocation
 		this->tracker_vec[result_idx].reset();
 
 		// Remove SingleTracker object from the vector
 		this->tracker_vec.erase(tracker_vec.begin() + result_idx);
+		this->invalidateGrid();
 
 		std::stringstream aux_str;
 
@@ -427,6 +926,44 @@ int TrackerManager::deleteTracker(int _target_id, std::string *last_event)
 
 /* -----------------------------------------------------------------------------------
 
+Function : findTrackersNear
+
+Spatial queries on the TrackerManager::tracker_vec, through a uniform grid with
+cells about the mean size of the targets. The grid is rebuilt, in one pass over
+the trackers, by the first query after the trackers moved, came or went, so it
+costs nothing on frames without queries.
+
+----------------------------------------------------------------------------------- */
+void TrackerManager::rebuildGrid()
+{
+	double mean_side = 0;
+	for (auto && s_tracker : this->tracker_vec)
+		mean_side += std::max(s_tracker->getRect().width, s_tracker->getRect().height);
+	if (!this->tracker_vec.empty())
+		mean_side /= this->tracker_vec.size();
+
+	this->grid.reset(std::max(16, static_cast<int>(mean_side)));
+	for (size_t t = 0; t < this->tracker_vec.size(); t++)
+		this->grid.insert(static_cast<int>(t), this->tracker_vec[t]->getRect());
+	this->grid_dirty = false;
+}
+
+void TrackerManager::findTrackersNear(const cv::Rect& _rect, std::vector<int>& _indices)
+{
+	if (this->grid_dirty)
+		this->rebuildGrid();
+	this->grid.query(_rect, _indices);
+}
+
+int TrackerManager::getGridCellSize()
+{
+	if (this->grid_dirty)
+		this->rebuildGrid();
+	return this->grid.getCellSize();
+}
+
+/* -----------------------------------------------------------------------------------
+
 Function : initTrackingSystem()
 
 Insert multiple SingleTracker objects to the manager.tracker_vec in once.
@@ -500,8 +1037,12 @@ int TrackingSystem::updateTrackingSystem(std::vector<std::pair<cv::Rect, int>> u
 	//Update init_target to detect new objects
 	//this->updated_target = updated_results;
 
+	// Labels and colors as given to the trackers
+	std::vector<std::pair<cv::Rect, int>> detections;
+	std::vector<cv::Scalar> colors;
+	detections.reserve(updated_results.size());
+	colors.reserve(updated_results.size());
 	for( auto && i : updated_results){
-		int index;
 		if (i.second == LABEL_CAR) {
 			color = COLOR_CAR;
 			label = LABEL_CAR;
@@ -510,9 +1051,24 @@ int TrackingSystem::updateTrackingSystem(std::vector<std::pair<cv::Rect, int>> u
 			color = COLOR_PERSON;
 			label = LABEL_PERSON;
 		}
-		index = this->manager.findTracker(i.first, label);
-		if ( index != -1) {
-			if (this->manager.insertTracker(i.first, color, index, label, true,this->last_event) == FAIL)
+		detections.push_back(std::make_pair(i.first, label));
+		colors.push_back(color);
+	}
+
+	// New trackers get their ids in order, insertTracker moves the next id past each of them
+	const std::vector<int> ids = this->manager.assignDetections(detections);
+
+	// The trackers left without detection missed this key frame
+	std::vector<int> matched(ids);
+	std::sort(matched.begin(), matched.end());
+	for (auto && s_tracker : this->manager.getTrackerVec()) {
+		if (!std::binary_search(matched.begin(), matched.end(), s_tracker->getTargetID())) {
+			s_tracker->detectionMissed();
+		}
+	}
+	for (size_t d = 0; d < detections.size(); d++) {
+		if ( ids[d] != -1) {
+			if (this->manager.insertTracker(detections[d].first, colors[d], ids[d], detections[d].second, true,this->last_event) == FAIL)
 			{
 				std::cout << "====================== Error Occured! =======================" << std::endl;
 				std::cout << "Function : int TrackingSystem::updateTrackingSystem" << std::endl;
@@ -546,30 +1102,62 @@ int TrackingSystem::startTracking(cv::Mat& _mat_img)
 		return FAIL;
 	}
 
-	// Convert _mat_img to dlib::array2d<unsigned char>
-	dlib::array2d<unsigned char> dlib_cur_frame = Util::cvtMatToArray2d(_mat_img);
+	// Convert the frame once, all SingleTrackers share the same grayscale image.
+	// In ROI mode every tracker converts its own search window instead.
+	const bool use_roi = this->roi_tracking && !this->batch_tracking;
+	if (!use_roi)
+		this->frame_cache.update(_mat_img);
+	else
+		this->frame_cache = FrameImageCache();
+	const FrameImageCache::view_type dlib_cur_frame = this->frame_cache.view();
 
-	// For all SingleTracker, do SingleTracker::startSingleTracking.
-	// Function startSingleTracking should be done before doSingleTracking
-	std::for_each(manager.getTrackerVec().begin(), manager.getTrackerVec().end(), [&](std::shared_ptr<SingleTracker> ptr) {
-		if (!(ptr.get()->getIsTrackingStarted()))
+	std::vector<std::shared_ptr<SingleTracker>>& trackers = manager.getTrackerVec();
+	if (this->batch_tracking)
+	{
+		// All filters are updated together, stage by stage, in the manager's arena
+		BatchCorrelationTracker& batch = manager.getBatchTracker();
+		for (auto && tracker : trackers)
 		{
-			ptr.get()->startSingleTracking(_mat_img);
-			ptr.get()->setIsTrackingStarted(true);
+			if (!tracker->getIsTrackingStarted())
+				tracker->setCoastPolicy(this->coast_policy);
+			tracker->prepareBatchTracking(batch);
 		}
-	});
-
-	std::vector<std::thread> thread_pool;
+		batch.update(dlib_cur_frame);
+		for (auto && tracker : trackers)
+			tracker->doBatchTracking(batch);
+	}
+	else
+	{
+		// For all SingleTracker, do SingleTracker::startSingleTracking.
+		// Function startSingleTracking should be done before doSingleTracking
+		std::for_each(manager.getTrackerVec().begin(), manager.getTrackerVec().end(), [&](std::shared_ptr<SingleTracker> ptr) {
+			if (!(ptr.get()->getIsTrackingStarted()))
+			{
+				ptr.get()->setFloatPrecision(this->float_tracking);
+				ptr.get()->setScaleSchedule(this->scale_schedule);
+				ptr.get()->setCoastPolicy(this->coast_policy);
+				if (use_roi)
+					ptr.get()->startSingleTrackingROI(_mat_img);
+				else
+					ptr.get()->startSingleTracking(dlib_cur_frame);
+				ptr.get()->setIsTrackingStarted(true);
+			}
+		});
 
-	// Multi thread
-	std::for_each(manager.getTrackerVec().begin(), manager.getTrackerVec().end(), [&](std::shared_ptr<SingleTracker> ptr) {
-		thread_pool.emplace_back([ptr, &_mat_img]() { 
-		 ptr.get()->doSingleTracking(_mat_img); 
+		// Multi thread, on the persistent pool shared by every camera.
+		// Coasting targets only run their motion model
+		ThreadPool::shared().parallelFor(0, trackers.size(), 0, [&](size_t i) {
+			if (trackers[i]->shouldCoast())
+				trackers[i]->coastSingleTracking();
+			else if (use_roi)
+				trackers[i]->doSingleTrackingROI(_mat_img);
+			else
+				trackers[i]->doSingleTracking(dlib_cur_frame);
 		});
-	});
+	}
 
-	for (int i = 0; i < thread_pool.size(); i++)
-		thread_pool[i].join();
+	// Every box moved
+	manager.invalidateGrid();
 
 	// If target is going out of the frame, delete that tracker.
 	std::vector<int> tracker_erase;
@@ -597,7 +1185,7 @@ Deallocate all memory and close the program.
 ----------------------------------------------------------------------------------- */
 int TrackingSystem::drawTrackingResult(cv::Mat& _mat_img)
 {
-	TrackerManager manager = this->getTrackerManager();
+	TrackerManager& manager = this->getTrackerManager();
 
 	// Exception
 	if (manager.getTrackerVec().size() == 0)
@@ -610,6 +1198,9 @@ int TrackingSystem::drawTrackingResult(cv::Mat& _mat_img)
 	}
 
 	std::for_each(manager.getTrackerVec().begin(), manager.getTrackerVec().end(), [&_mat_img](std::shared_ptr<SingleTracker> ptr) {
+		// Lost targets are somewhere else
+		if (!ptr.get()->isActive())
+			return;
 		// Draw all rectangles
 		cv::rectangle(_mat_img, ptr.get()->getRect(), ptr.get()->getColor(), 1);
 		// Draw velocities
@@ -708,11 +1299,14 @@ bool isValidCollision(std::pair<double, int> area1, std::pair<double, int> area2
 Function : detectCollisions
 
 Draw red circle when collision is detected and write to log.
+Pairs whose boxes will intersect within collision_frames frames, moving at the
+velocity of their motion models, are reported too, with a thin circle.
 
 ----------------------------------------------------------------------------------- */
 int TrackingSystem::detectCollisions(cv::Mat& _mat_img)
 {
-	TrackerManager manager = this->getTrackerManager();
+	const int collision_frames = 5;
+	TrackerManager& manager = this->getTrackerManager();
 
 	// Exception
 	if (manager.getTrackerVec().size() == 0)
@@ -724,22 +1318,53 @@ int TrackingSystem::detectCollisions(cv::Mat& _mat_img)
 		return FAIL;
 	}
 
-	std::vector<std::shared_ptr<SingleTracker>> trackerVec = manager.getTrackerVec();
-	for (auto i = trackerVec.begin(); i != trackerVec.end(); ++i) {
-		SingleTracker iRef = *(*i);
-		for (auto j = i + 1; j != trackerVec.end(); ++j) {
-		SingleTracker jRef = *(*j);
-		cv::Rect recti = iRef.getRect();
+	// Boxes collision_frames ahead, the grid holds the current boxes so the
+	// queries are grown by the largest displacement of any target
+	const std::vector<std::shared_ptr<SingleTracker>>& trackerVec = manager.getTrackerVec();
+	std::vector<cv::Rect> ahead(trackerVec.size());
+	int max_shift = 0;
+	for (size_t i = 0; i < trackerVec.size(); ++i) {
+		const cv::Point2d v = trackerVec[i]->getMotionVel() * collision_frames;
+		const cv::Point shift(std::round(v.x), std::round(v.y));
+		ahead[i] = trackerVec[i]->getRect() + shift;
+		max_shift = std::max(max_shift, std::max(std::abs(shift.x), std::abs(shift.y)));
+	}
+
+	std::vector<int> near;
+	for (size_t i = 0; i < trackerVec.size(); ++i) {
+		SingleTracker& iRef = *trackerVec[i];
+		const cv::Rect recti = iRef.getRect();
+		const cv::Rect reach = recti | ahead[i];
+		manager.findTrackersNear(cv::Rect(reach.x - max_shift, reach.y - max_shift, reach.width + 2 * max_shift, reach.height + 2 * max_shift), near);
+		for (auto && j : near) {
+		if (j <= static_cast<int>(i) || !iRef.isActive() || !trackerVec[j]->isActive()) {
+			continue;
+		}
+		SingleTracker& jRef = *trackerVec[j];
 		cv::Rect rectj = jRef.getRect();
 		bool intersects = ((recti & rectj).area() > 0);
-		if (intersects && isValidCollision(std::make_pair(recti.area(),iRef.getLabel()),std::make_pair(rectj.area(),jRef.getLabel()))) {
+		bool will_intersect = ((ahead[i] & ahead[j]).area() > 0);
+		if (!intersects && !will_intersect) {
+			continue;
+		}
+		if (!isValidCollision(std::make_pair(recti.area(),iRef.getLabel()),std::make_pair(rectj.area(),jRef.getLabel()))) {
+			continue;
+		}
+		if (intersects) {
 			std::cout<<"Collision between object "<<iRef.getTargetID()<<" and "<<jRef.getTargetID()<<std::endl;
 			cv::circle(_mat_img,
 					   (iRef.getCenter() + jRef.getCenter())*.5,
 					   10, //radius
 					   cv::Scalar(0,0,255),
 					   3); //width
-			}
+		} else {
+			std::cout<<"Object "<<iRef.getTargetID()<<" and "<<jRef.getTargetID()<<" on collision course"<<std::endl;
+			cv::circle(_mat_img,
+					   ((ahead[i].tl() + ahead[i].br()) + (ahead[j].tl() + ahead[j].br()))*.25,
+					   10, //radius
+					   cv::Scalar(0,0,255),
+					   1); //width
+		}
 		}
 	}
 
@@ -5,6 +5,7 @@
 #include <dlib/image_io.h>
 #include <dlib/dir_nav.h>
 #include <dlib/opencv.h>
+#include <dlib/filtering/kalman_filter.h>
 
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgproc.hpp>
@@ -13,6 +14,8 @@
 #include <boost/circular_buffer.hpp>
 
 #include "yolo_labels.hpp"
+#include "batch_tracker.hpp"
+#include "spatial_grid.hpp"
 
 #define FAIL		-1
 #define SUCCESS		1
@@ -29,6 +32,132 @@ const cv::Scalar COLOR_CAR = cv::Scalar(0, 255, 0);
 const cv::Scalar COLOR_PERSON = cv::Scalar(255, 255, 0);
 
 const int n_frames = 50; // Number of positions to save in the circular buffer
+const int vel_frames = 20; // The velocity vector is the motion over this many frames
+
+/* ==========================================================================
+
+Class : FrameImageCache
+
+Per-frame image cache for the trackers.
+The frame is converted to grayscale once, in a buffer reused from frame to frame,
+and every SingleTracker reads it through a zero-copy dlib::cv_image view.
+
+========================================================================== */
+class FrameImageCache
+{
+private:
+	cv::Mat		gray;				// Grayscale copy of the current frame
+
+public:
+	typedef dlib::cv_image<unsigned char> view_type;
+
+	/* Core Function */
+	// Convert the new frame, call it once per frame before handing out views
+	void update(const cv::Mat& _mat_img);
+
+	/* Get Function */
+	view_type	view() const { return view_type(this->gray); }
+	bool		empty() const { return this->gray.empty(); }
+};
+
+/* ==========================================================================
+
+Struct : SearchWindow
+
+Maps between frame coordinates and the coordinates of the cropped, possibly
+downscaled, search window a SingleTracker is updated on.
+The default one is the whole frame.
+
+========================================================================== */
+struct SearchWindow
+{
+	cv::Point2d	origin;				// Top left corner of the window in the frame
+	double		scale;				// Window pixels per frame pixel
+
+	SearchWindow() : origin(0, 0), scale(1) {}
+
+	dlib::drectangle toWindow(const dlib::drectangle& _drect) const
+	{
+		return dlib::drectangle((_drect.left() - origin.x) * scale, (_drect.top() - origin.y) * scale,
+			(_drect.right() - origin.x) * scale, (_drect.bottom() - origin.y) * scale);
+	}
+	dlib::drectangle toFrame(const dlib::drectangle& _drect) const
+	{
+		return dlib::drectangle(_drect.left() / scale + origin.x, _drect.top() / scale + origin.y,
+			_drect.right() / scale + origin.x, _drect.bottom() / scale + origin.y);
+	}
+};
+
+/* ==========================================================================
+
+Struct : ScaleSchedule
+
+When a SingleTracker runs the scale estimation of its correlation tracker.
+It costs several times the position update, so in ADAPTIVE mode it only runs
+when the PSR drops below a fraction of its running mean, while the box area
+keeps changing, and at least every interval frames.
+
+========================================================================== */
+struct ScaleSchedule
+{
+	enum Mode { NEVER, ADAPTIVE, ALWAYS };
+
+	Mode		mode;
+	int		interval;			// ADAPTIVE: frames between two estimations at most
+	double		psr_drop;			// ADAPTIVE: estimate when PSR < psr_drop * mean PSR
+	double		area_rate;			// ADAPTIVE: estimate again while the area changes more than this per estimation
+
+	ScaleSchedule() : mode(NEVER), interval(10), psr_drop(0.7), area_rate(0.02) {}
+};
+
+/* ==========================================================================
+
+Struct : CoastPolicy
+
+Which targets skip the correlation update and only move with their motion model.
+Small targets, slow ones such as parked cars, and targets tracked with a high
+PSR for several updates in a row coast for up to interval frames, then one
+correlation update checks where they really are.
+An interval of 0 never coasts.
+
+========================================================================== */
+struct CoastPolicy
+{
+	int		interval;			// Frames a target coasts between two correlation updates at most
+	int		min_side;			// Targets whose largest side is below this coast
+	double		max_speed;			// Targets slower than this, in pixels per frame, coast
+	double		stable_psr;			// Targets with a PSR above this...
+	int		stable_updates;			// ...in this many correlation updates in a row coast
+
+	CoastPolicy() : interval(0), min_side(20), max_speed(0.5), stable_psr(20), stable_updates(5) {}
+};
+
+/* ==========================================================================
+
+Struct : TrackLifecycle
+
+Thresholds of the track state machine of SingleTracker.
+A track starts TENTATIVE and is CONFIRMED by a few detections. A confirmed
+track is LOST after several frames of low PSR or several key frames without
+a detection, a tentative one is DELETED instead. The PSR has two thresholds
+so a track hovering around one of them does not flip back and forth.
+A LOST track keeps its correlation filter without updating it, and a new
+detection of the target brings it back under its old id. It is DELETED when
+nothing finds it for max_lost_frames frames.
+
+========================================================================== */
+struct TrackLifecycle
+{
+	int		confirm_hits;			// Detections confirming a tentative track
+	int		tentative_misses;		// Key frames in a row without detection deleting a tentative track
+	int		confirmed_misses;		// Key frames in a row without detection losing a confirmed track
+	double		low_psr;			// A correlation update below this PSR counts as a failure...
+	double		high_psr;			// ...and only one above this clears the failures
+	int		low_psr_frames;			// Failures losing the track
+	int		max_lost_frames;		// Frames a lost track waits for a detection
+
+	TrackLifecycle() : confirm_hits(2), tentative_misses(2), confirmed_misses(4), low_psr(5), high_psr(8), low_psr_frames(3), max_lost_frames(50) {}
+};
 
 /* ==========================================================================
 
@@ -42,6 +171,9 @@ then need to have 'Three' SingleTracker object.
 ========================================================================== */
 class SingleTracker
 {
+public:
+	enum TrackState { TENTATIVE, CONFIRMED, LOST, DELETED };
+
 private:
 	int		target_id;			// Unique Number for target
 	double		confidence;			// Confidence of tracker
@@ -58,14 +190,62 @@ private:
 	bool		update;				// Update from Detection (new rois)
 	bool		to_delete;			// Mark for deletion
 	int		no_update_counter;		// Counter if object doesn't get updated
+	dlib::drectangle	position;			// Sub-pixel target position in frame coordinates
+	cv::Mat		window_gray;			// Grayscale search window before downscaling
+	cv::Mat		window_img;			// Search window handed to the tracker, buffers reused across frames
+	bool		float_precision;		// Track with tracker_float instead of tracker
+	int		batch_slot;			// Slot in the BatchCorrelationTracker, -1 if none
+	ScaleSchedule	scale_schedule;			// When to estimate the scale of the target
+	int		frames_since_scale;		// Position updates since the last scale estimation
+	double		mean_psr;			// Running mean of the PSR, 0 until the first update
+	bool		scale_changing;			// The last scale estimation changed the area fast
+	dlib::kalman_filter<4, 2>	motion;		// Constant velocity model of the center, state (x, y, vx, vy) in pixels and pixels per frame
+	CoastPolicy	coast_policy;			// When to skip the correlation update
+	int		coast_frames;			// Frames coasted since the last correlation update
+	int		stable_count;			// Correlation updates in a row with a PSR above coast_policy.stable_psr
+	bool		coasting;			// Batch mode: the target is left out of the current update
+	bool		batch_started;			// Batch mode: the slot (re)starts in the current update, it has no PSR
+
+	TrackLifecycle	lifecycle;			// Thresholds of the state machine
+	TrackState	state;				// Where the track is in its life
+	int		hits;				// Detections of the target
+	int		misses;				// Key frames in a row without detection
+	int		low_psr_count;			// Correlation updates failed since the last good one
+	int		lost_frames;			// Frames since the track got lost
+	bool		reacquired;			// A detection found the lost target, keep its filter
+
+	// Bookkeeping of the coasting policy and the state machine after a correlation update
+	void correlationDone(double _psr);
+	void loseTrack();
+
+	// Set the matrices of the motion model
+	void initMotionModel();
+
+	// Crop, convert and downscale the search window of this target out of the color frame
+	SearchWindow extractSearchWindow(const cv::Mat& _mat_img);
+
+	// Track the target on img, which covers the window part of the frame
+	int trackInWindow(const FrameImageCache::view_type& _img, const SearchWindow& _window);
+
+	// Forward to the correlation tracker of the selected precision
+	void startTrack(const FrameImageCache::view_type& _img, const dlib::drectangle& _drect);
+	double updateTrack(const FrameImageCache::view_type& _img, const dlib::drectangle& _guess);
+	void updateTrackScale(const FrameImageCache::view_type& _img);
+	dlib::drectangle getTrackerPosition() const;
+
+	// Decide from the PSR of the position update whether the scale is estimated this frame
+	bool needsScaleUpdate(double _psr);
 
 public:
 	dlib::correlation_tracker tracker;  // Correlation tracker
+	dlib::correlation_tracker_float tracker_float;  // Single precision, SIMD correlation tracker
 
 	/* Member Initializer & Constructor*/
 	SingleTracker(int _target_id, cv::Rect _init_rect, cv::Scalar _color, int _label)
-		: target_id(_target_id), confidence(0), is_tracking_started(false), c_q(boost::circular_buffer<cv::Point>(n_frames)), modvel(0), vel_x(0), vel_y(0), to_delete(false), no_update_counter(0)
+		: target_id(_target_id), confidence(0), is_tracking_started(false), c_q(boost::circular_buffer<cv::Point>(n_frames)), modvel(0), vel_x(0), vel_y(0), update(false), to_delete(false), no_update_counter(0), float_precision(false), batch_slot(-1), frames_since_scale(0), mean_psr(0), scale_changing(false), coast_frames(0), stable_count(0), coasting(false), batch_started(false), state(TENTATIVE), hits(1), misses(0), low_psr_count(0), lost_frames(0), reacquired(false)
 	{
+		this->initMotionModel();
+
 		// Exception
 		if (_init_rect.area() == 0)
 		{
@@ -101,6 +281,13 @@ public:
 	bool		getUpdateFromDetection() { return this->update; }
 	bool		getDelete() { return this->to_delete; }
 	int		getNoUpdateCounter() { return this->no_update_counter; }
+	bool		getFloatPrecision() { return this->float_precision; }
+	int		getBatchSlot() { return this->batch_slot; }
+	ScaleSchedule	getScaleSchedule() { return this->scale_schedule; }
+	CoastPolicy	getCoastPolicy() { return this->coast_policy; }
+	TrackState	getState() { return this->state; }
+	// Tentative and confirmed tracks follow their target, lost ones wait to be found again
+	bool		isActive() { return this->state == TENTATIVE || this->state == CONFIRMED; }
 
 	/* Set Function */
 	void setTargetId(int _target_id) { this->target_id = _target_id; }
@@ -116,6 +303,10 @@ public:
 	void setLabel(int _label) { this->label = _label; }
 	void setUpdateFromDetection(bool _update) { this->update = _update; }
 	void setNoUpdateCounter(int _counter) { this->no_update_counter = _counter; }
+	void setFloatPrecision(bool _float_precision) { this->float_precision = _float_precision; }
+	void setScaleSchedule(const ScaleSchedule& _scale_schedule) { this->scale_schedule = _scale_schedule; }
+	void setCoastPolicy(const CoastPolicy& _coast_policy) { this->coast_policy = _coast_policy; }
+	void setTrackLifecycle(const TrackLifecycle& _lifecycle) { this->lifecycle = _lifecycle; }
 
 	/* Velocity Related */
 	void saveLastCenter(cv::Point _center) { this->c_q.push_back(_center); }
@@ -123,17 +314,37 @@ public:
 	void updateVel_Y() { this->vel_y = this->getVel().y - this->getCenter().y; }
 	void updateModVel() { this->modvel = sqrt(this->vel_x*this->vel_x + this->vel_y*this->vel_y); }
 	void calcVel();
+	// Velocity of the motion model, in pixels per frame
+	cv::Point2d getMotionVel() const;
+	// Current box moved to where the motion model expects the target in the next frame
+	dlib::drectangle predictPosition() const;
 
 	/* Core Function */
 	// Initialize
-	int startSingleTracking(cv::Mat _mat_img);
+	int startSingleTracking(const FrameImageCache::view_type& _img);
+	int startSingleTrackingROI(const cv::Mat& _mat_img);
+
+	// Do tracking. ROI variant works on the target's search window only,
+	// so its cost depends on the target size, not on the frame size.
+	int doSingleTracking(const FrameImageCache::view_type& _img);
+	int doSingleTrackingROI(const cv::Mat& _mat_img);
 
-	// Do tracking
-	int doSingleTracking(cv::Mat _mat_img);
+	// Cheap update: move the target with its motion model only, see CoastPolicy
+	bool shouldCoast();
+	int coastSingleTracking();
+
+	// Batch variant: queue this target in the shared arena before BatchCorrelationTracker::update,
+	// then read the result back. A coasting target is held out of the update
+	void prepareBatchTracking(BatchCorrelationTracker& _batch);
+	int doBatchTracking(const BatchCorrelationTracker& _batch);
 
 	// Check the target is inside of the frame
 	int isTargetInsideFrame(int _frame_width, int _frame_height);
 
+	// Track state machine, fed by the detections of the key frames
+	void detectionHit();
+	void detectionMissed();
+
 	// Check if tracker needs to be deleted
 	int markForDeletion();
 };
@@ -152,11 +363,17 @@ class TrackerManager
 {
 private:
 	std::vector<std::shared_ptr<SingleTracker>> tracker_vec; // Vector filled with SingleTracker shared pointer. It is the most important container in this program.
+	BatchCorrelationTracker batch_tracker; // Filters of the trackers running in batch mode, SingleTracker keeps its slot index
 	int id_list = 0; // We keep this to be able to apply new ID to new objects in a simple way.
+	SpatialGrid grid; // Index of tracker_vec by box, rebuilt on the first query after the boxes change
+	bool grid_dirty = true;
+
+	void rebuildGrid();
 
 public:
 	/* Get Function */
 	std::vector<std::shared_ptr<SingleTracker>>& getTrackerVec() { return this->tracker_vec; } // Return reference! not value!
+	BatchCorrelationTracker& getBatchTracker() { return this->batch_tracker; }
 	int getNextID() { return this->id_list; }
 
 	/* Core Function */
@@ -164,13 +381,20 @@ public:
 	int insertTracker(cv::Rect _init_rect, cv::Scalar _color, int _target_id, int _label, bool _update, std::string *last_event);
 	int insertTracker(std::shared_ptr<SingleTracker> new_single_tracker, bool _update);
 
-	// Find SingleTracker by similarity and return id, return new id if no coincidence
-	int findTracker(cv::Rect rect, int label);
+	// Match all the detections of a frame to the trackers at once. For every detection, returns the id
+	// of its tracker, a new id if it overlaps no tracker, or -1 to ignore it
+	std::vector<int> assignDetections(const std::vector<std::pair<cv::Rect, int>>& _detections);
 	// Find SingleTracker in the TrackerManager::tracker_vec using SingleTracker::target_id
 	int findTrackerByID(int _target_id);
 
 	// Deleter SingleTracker which has ID : _target_id from TrackerManager::tracker_vec
 	int deleteTracker(int _target_id, std::string *last_event);
+
+	// Indices in TrackerManager::tracker_vec of the trackers whose box may overlap _rect, in increasing order.
+	// Call invalidateGrid() after moving the trackers, insertTracker and deleteTracker do it themselves
+	void findTrackersNear(const cv::Rect& _rect, std::vector<int>& _indices);
+	void invalidateGrid() { this->grid_dirty = true; }
+	int getGridCellSize();
 };
 
 /* ===================================================================================================
@@ -191,6 +415,12 @@ private:
 	int				frame_width;	// Frame image width
 	int				frame_height;	// Frame image height
 	cv::Mat			current_frame;	// Current frame
+	FrameImageCache		frame_cache;	// Grayscale current frame shared by all trackers
+	bool			roi_tracking = false;	// Update trackers on their search windows only
+	bool			float_tracking = false;	// New trackers use the single precision correlation tracker
+	bool			batch_tracking = false;	// Track all targets together with the manager's BatchCorrelationTracker
+	ScaleSchedule		scale_schedule;	// Scale estimation of new trackers, the batched tracker has none
+	CoastPolicy		coast_policy;	// Coasting of new trackers
 	std::vector<std::pair<cv::Rect, int>> init_target;
 	std::vector<std::pair<cv::Rect, int>> updated_target;
 	std::string 	*last_event;
@@ -204,7 +434,7 @@ public:
 	int    getFrameWidth() { return this->frame_width; }
 	int    getFrameHeight() { return this->frame_height; }
 	cv::Mat   getCurrentFrame() { return this->current_frame; }
-	TrackerManager getTrackerManager() { return this->manager; }
+	TrackerManager& getTrackerManager() { return this->manager; }
 
 
 	/* Set Function */
@@ -213,6 +443,11 @@ public:
 	void   setFrameHeight(int _frame_height) { this->frame_height = _frame_height; }
 	void   setCurrentFrame(cv::Mat _current_frame) { this->current_frame = _current_frame; }
 	void   setInitTarget(std::vector<std::pair<cv::Rect, int>> _init_target) { this->init_target = _init_target; }
+	void   setRoiTracking(bool _roi_tracking) { this->roi_tracking = _roi_tracking; }
+	void   setFloatTracking(bool _float_tracking) { this->float_tracking = _float_tracking; }
+	void   setBatchTracking(bool _batch_tracking) { this->batch_tracking = _batch_tracking; }
+	void   setScaleSchedule(const ScaleSchedule& _scale_schedule) { this->scale_schedule = _scale_schedule; }
+	void   setCoastPolicy(const CoastPolicy& _coast_policy) { this->coast_policy = _coast_policy; }
 
 	/* Core Function */
 	// Initialize TrackingSystem
@@ -1,43 +1,5 @@
 #include "base_detection.hpp"
-
-void BaseDetection::submitRequest() 
-{
-    if (! this -> enabled() || nullptr == this -> requests[this -> inputRequestIdx]) return;
-    this -> requests[this -> inputRequestIdx]->StartAsync();
-    this -> submittedRequests.push(this -> requests[this -> inputRequestIdx]);
-    (this -> inputRequestIdx)++;
-    if (this-> inputRequestIdx >= this -> maxSubmittedRequests) {
-	   this -> inputRequestIdx = 0;
-    }
-}
-
-bool BaseDetection::resultIsReady() {
-   if (this -> submittedRequests.size() < 1) return false;
-   InferenceEngine::StatusCode state = this -> submittedRequests.front()->Wait(InferenceEngine::IInferRequest::WaitMode::STATUS_ONLY);
-   return (InferenceEngine::StatusCode::OK == state);
-}
-
-void BaseDetection::wait() 
-{
-    if (!this -> enabled()) return;
-    // get next request to wait on
-    if (nullptr == this -> outputRequest) {
-        if (this -> submittedRequests.size() < 1) return;
-        this -> outputRequest = this -> submittedRequests.front();
-        this -> submittedRequests.pop();
-    }
-    this -> outputRequest->Wait(InferenceEngine::IInferRequest::WaitMode::RESULT_READY);
-}
-
-bool BaseDetection::requestsInProcess() {
-    // request is in progress if number of outstanding requests is > 0
-    return (this -> submittedRequests.size() > 0);
-}
-
- bool BaseDetection::canSubmitRequest() {
-    // ready when another request can be submitted
-    return (this -> submittedRequests.size() < this -> maxSubmittedRequests);
-}
+#include "preprocess_cache.hpp"
 
 bool BaseDetection::enabled() const  {
     if (!this -> enablingChecked) {
@@ -54,77 +16,212 @@ void BaseDetection::printPerformanceCounts() {
         return;
     }
     // use last request used
-    int idx = std::max(0, (this -> inputRequestIdx)-1);
+    int idx = this -> inputRequestIdx;
     slog::info << "Performance counts for " << this -> topoName << slog::endl << slog::endl;
     ::printPerformanceCounts(this -> requests[idx]->GetPerformanceCounts(), std::cout, false);
 }
 
+void resizeToPlanar(const cv::Mat &frame, int width, int height, uint8_t *planes) {
+    // one buffer per preprocessing thread, reused from frame to frame
+    thread_local cv::Mat resized;
+    const cv::Mat *src = &frame;
+    if (frame.cols != width || frame.rows != height) {
+        cv::resize(frame, resized, cv::Size(width, height));
+        src = &resized;
+    }
+    // headers over the destination planes, split() writes through them
+    const size_t planeSize = static_cast<size_t>(width) * height;
+    cv::Mat planeMats[3];
+    for (int c = 0; c < 3; c++) {
+        planeMats[c] = cv::Mat(height, width, CV_8UC1, planes + c * planeSize);
+    }
+    cv::split(*src, planeMats);
+}
+
+bool canWritePlanarU8(const InferenceEngine::TensorDesc &desc, const cv::Mat &frame) {
+    const InferenceEngine::SizeVector &dims = desc.getDims();
+    return desc.getLayout() == InferenceEngine::Layout::NCHW && desc.getPrecision() == InferenceEngine::Precision::U8
+        && dims.size() == 4 && dims[1] == 3 && frame.channels() == 3 && frame.depth() == CV_8U;
+}
+
+void frameToPlanarBlob(const cv::Mat &frame, InferenceEngine::Blob::Ptr &blob, int batchIndex) {
+    const InferenceEngine::TensorDesc &desc = blob->getTensorDesc();
+    if (!canWritePlanarU8(desc, frame)) {
+        matU8ToBlob<uint8_t>(frame, blob, batchIndex);
+        return;
+    }
+    const InferenceEngine::SizeVector &dims = desc.getDims();
+    const int channels = static_cast<int>(dims[1]);
+    const int height = static_cast<int>(dims[2]);
+    const int width = static_cast<int>(dims[3]);
+    const size_t imageSize = static_cast<size_t>(channels) * width * height;
+    resizeToPlanar(frame, width, height, blob->buffer().as<uint8_t *>() + batchIndex * imageSize);
+}
+
 void BaseDetection::enqueue(const cv::Mat &frame){}
 
 void BaseDetection::fetchResults(int inputBatchSize){}
 
-void BaseDetection::run_inferrence(FramePipelineFifo *in_fifo){
-    FramePipelineFifo& in = *in_fifo; 
-    if (!in.empty() && (this ->canSubmitRequest())) {
-        FramePipelineFifoItem ps0i = in.front();
-        in.pop();
-        for(auto &&  i: ps0i.batchOfInputFrames){
-            cv::Mat* curFrame = i;
-            //t0 = std::chrono::high_resolution_clock::now();
-            this -> enqueue(*curFrame);
-            //t1 = std::chrono::high_resolution_clock::now();
-            //ocv_decode_time_vehicle += std::chrono::duration_cast<ms>(t1 - t0).count();
+void BaseDetection::clearResults(int inputBatchSize){
+    if (static_cast<int>(this -> results.size()) < inputBatchSize) {
+        this -> results.resize(inputBatchSize);
+    }
+    for (auto && imageResults : this -> results) {
+        imageResults.clear();
+    }
+}
+
+void BaseDetection::fillInputBlob(const cv::Mat &frame, InferenceEngine::Blob::Ptr &blob, int batchIndex){
+    if (nullptr != this -> preprocessCache) {
+        this -> preprocessCache -> fill(&frame, blob, batchIndex);
+    } else {
+        frameToPlanarBlob(frame, blob, batchIndex);
+    }
+}
+
+void BaseDetection::createRequests(){
+    for (int i = 0; i < this -> maxSubmittedRequests; i++) {
+        if (nullptr == this -> requests[i]) {
+            this -> requests[i] = this -> net.CreateInferRequestPtr();
         }
-        //t0 = std::chrono::high_resolution_clock::now();
-        this -> submitRequest();
-        this -> S1toS2.push(ps0i);
-        this -> next_pipe = true;
+        // Runs on an inference engine thread as soon as the request is done.
+        // The queue holds one slot per request plus the end marker so this
+        // never blocks.
+        std::function<void()> onDone = [this, i] {
+            Completion done;
+            done.requestIdx = i;
+            done.sequence = this -> running[i].sequence;
+            done.last = false;
+            this -> completed.enqueue(done);
+        };
+        this -> requests[i]->SetCompletionCallback(onDone);
     }
 }
 
-void BaseDetection::run_inferrence(FramePipelineFifo *i, FramePipelineFifo *o2){
-    this -> run_inferrence(i);
-    if(this -> next_pipe == true ){
-        this -> next_pipe = false;
-        FramePipelineFifo& in = this -> S1toS2; 
-        FramePipelineFifo& out2 = *o2;
-        FramePipelineFifoItem i2 = in.back();
-        out2.push(i2);
+void BaseDetection::preprocess_stage(FramePipelineQueue *in){
+    FramePipelineFifoItem ps0i;
+    while (in -> dequeue(ps0i)) {
+        // Wait for a request nobody else is using, this bounds the number of
+        // batches in flight to maxSubmittedRequests. Batches that skip
+        // inference hold one too, so they queue up behind the others.
+        int requestIdx;
+        if (!this -> freeRequests.dequeue(requestIdx)) break;
+        if (!ps0i.keyFrame) {
+            // the tracking system carries the targets over this batch
+            InFlightItem skipped;
+            skipped.item = ps0i;
+            skipped.requestIdx = requestIdx;
+            if (!this -> preprocessed.enqueue(skipped)) break;
+            continue;
+        }
+        this -> inputRequestIdx = requestIdx;
+        this -> enquedFrames = 0;
+        for (auto && curFrame : ps0i.batchOfInputFrames) {
+            this -> enqueue(*curFrame);
+        }
+        if (nullptr != this -> preprocessCache) {
+            // done with the shared conversions of these frames, even the ones enqueue() skipped
+            for (auto && curFrame : ps0i.batchOfInputFrames) {
+                this -> preprocessCache -> release(curFrame);
+            }
+        }
+        InFlightItem inFlight;
+        inFlight.item = ps0i;
+        inFlight.requestIdx = requestIdx;
+        if (!this -> preprocessed.enqueue(inFlight)) break;
     }
+    closeWhenDrained(this -> preprocessed);
 }
 
+void BaseDetection::submit_stage(){
+    InFlightItem inFlight;
+    long long sequence = 0;
+    while (this -> preprocessed.dequeue(inFlight)) {
+        // The callback reads it back, so it must be in place before starting
+        inFlight.sequence = sequence++;
+        this -> running[inFlight.requestIdx] = inFlight;
+        if (!inFlight.item.keyFrame) {
+            // nothing to infer, straight to the collect stage
+            Completion skipped;
+            skipped.requestIdx = inFlight.requestIdx;
+            skipped.sequence = inFlight.sequence;
+            skipped.last = false;
+            if (!this -> completed.enqueue(skipped)) break;
+            continue;
+        }
+        if (this -> dynamicBatch) {
+            // partial batches (end of stream, deadline flushes) skip the empty slots
+            this -> requests[inFlight.requestIdx]->SetBatch(std::min<int>(inFlight.item.batchOfInputFrames.size(), this -> maxBatch));
+        }
+        this -> requests[inFlight.requestIdx]->StartAsync();
+    }
+    // Tell the collect stage how many batches are still to come back
+    Completion end;
+    end.requestIdx = -1;
+    end.sequence = sequence;
+    end.last = true;
+    this -> completed.enqueue(end);
+}
 
-void BaseDetection::wait_results(FramePipelineFifo *o){
-    FramePipelineFifo& in = this -> S1toS2; 
-    FramePipelineFifo& out = *o; 
-    
-    if (((this -> maxSubmittedRequests == 1) && this -> requestsInProcess()) || this -> resultIsReady()) {
-        this -> wait();
-        //t1 = std::chrono::high_resolution_clock::now();
-        //detection_time = std::chrono::duration_cast<ms>(t1 - t0);
-        FramePipelineFifoItem ps0s1i = in.front();
-        in.pop();
-        this -> fetchResults(ps0s1i.batchOfInputFrames.size());
+void BaseDetection::collect_stage(FramePipelineQueue *out){
+    // Batches that finished ahead of an older one, by submission order. The
+    // tracking stage pairs frames across detectors, so they leave in order.
+    std::map<long long, std::vector<FramePipelineFifoItem>> finished;
+    long long nextSequence = 0;
+    long long submittedCount = -1;  // Unknown until the end marker arrives
+    bool outOpen = true;
+    Completion done;
+    while (outOpen && nextSequence != submittedCount && this -> completed.dequeue(done)) {
+        if (done.last) {
+            submittedCount = done.sequence;
+            continue;
+        }
+        FramePipelineFifoItem& ps0s1i = this -> running[done.requestIdx].item;
+        const bool inferred = ps0s1i.keyFrame;
+        this -> clearResults(ps0s1i.batchOfInputFrames.size());
+        if (inferred) {
+            this -> outputRequest = this -> requests[done.requestIdx];
+            // Already complete, this only surfaces an inference error
+            this -> outputRequest->Wait(InferenceEngine::IInferRequest::WaitMode::RESULT_READY);
+            this -> outputFrameSizes.clear();
+            for (auto && bFrame : ps0s1i.batchOfInputFrames) {
+                this -> outputFrameSizes.push_back(bFrame->size());
+            }
+            this -> fetchResults(ps0s1i.batchOfInputFrames.size());
+        }
         // prepare a FramePipelineFifoItem for each batched frame to get its detection results
-        std::vector<FramePipelineFifoItem> batchedFifoItems;
-        for (auto && bFrame : ps0s1i.batchOfInputFrames) {
+        std::vector<FramePipelineFifoItem>& batchedFifoItems = finished[done.sequence];
+        for (size_t k = 0; k < ps0s1i.batchOfInputFrames.size(); k++) {
             FramePipelineFifoItem fpfi;
-            fpfi.outputFrame = bFrame;
+            fpfi.outputFrame = ps0s1i.batchOfInputFrames[k];
+            fpfi.streamId = k < ps0s1i.batchOfStreamIds.size() ? ps0s1i.batchOfStreamIds[k] : 0;
+            fpfi.keyFrame = inferred;
+            fpfi.numVehiclesInferred = 0;
+            fpfi.vehicleDetectionDone = inferred;
+            fpfi.pedestriansDetectionDone = false;
+            // store results for next pipeline stage, they are already grouped by image
+            fpfi.resultsLocations.reserve(this -> results[k].size());
+            for (auto && result : this -> results[k]) {
+                fpfi.resultsLocations.push_back(std::make_pair(result.location, result.label));
+            }
             batchedFifoItems.push_back(fpfi);
         }
-        // store results for next pipeline stage
-        for (auto && result : this -> results) {
-            FramePipelineFifoItem& fpfi = batchedFifoItems[result.batchIndex];
-            fpfi.resultsLocations.push_back(std::make_pair(result.location, result.label));
-        }
-        // done with results, clear them
-        this -> results.clear();
-        // queue up output for next pipeline stage to process
-        for (auto && item : batchedFifoItems) {
-            item.numVehiclesInferred = 0;
-            item.vehicleDetectionDone = true;
-            item.pedestriansDetectionDone = false;
-            out.push(item);
+        // request can be reused by the preprocess stage from now on
+        int requestIdx = done.requestIdx;
+        this -> freeRequests.enqueue(requestIdx);
+        // queue up output for next pipeline stage to process, oldest first
+        for (auto it = finished.begin(); outOpen && it != finished.end() && it->first == nextSequence; it = finished.erase(it)) {
+            for (auto && item : it->second) {
+                if (!(outOpen = out -> enqueue(item))) break;
+            }
+            nextSequence++;
         }
     }
-}
\ No newline at end of file
+    closeWhenDrained(*out);
+}
+
+void BaseDetection::abort(){
+    this -> freeRequests.disable();
+    this -> preprocessed.disable();
+    this -> completed.disable();
+}
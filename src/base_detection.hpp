@@ -15,6 +15,7 @@
 #include <utility>
 
 #include <inference_engine.hpp>
+#include <dlib/pipe.h>
 
 #include <samples/common.hpp>
 #include <samples/slog.hpp>
@@ -22,6 +23,9 @@
 
 typedef struct {
             std::vector<cv::Mat*> batchOfInputFrames;
+            std::vector<int> batchOfStreamIds;  // Stream of each batched frame, see StreamBatcher
+            int streamId;                       // Stream of outputFrame
+            bool keyFrame;                      // The detectors run on these frames, see DetectionScheduler
             bool vehicleDetectionDone;
             bool pedestriansDetectionDone;
             bool generalDetectionDone;
@@ -30,7 +34,33 @@ typedef struct {
             int numPedestriansInferred;
             std::vector<std::pair<cv::Rect, int>> resultsLocations;
 } FramePipelineFifoItem;
-typedef std::queue<FramePipelineFifoItem> FramePipelineFifo;
+// Bounded, thread safe FIFO joining two pipeline stages. A full queue blocks
+// its producer, which gives us backpressure from the slowest stage.
+typedef dlib::pipe<FramePipelineFifoItem> FramePipelineQueue;
+
+// Closes a pipeline queue once the consumer has drained everything queued so far.
+template <typename T>
+void closeWhenDrained(dlib::pipe<T> &queue) {
+    queue.wait_until_empty();
+    queue.disable();
+}
+
+class PreprocessCache;
+
+// Resizes a BGR frame into width x height and writes its three planes one
+// after the other at planes.
+void resizeToPlanar(const cv::Mat &frame, int width, int height, uint8_t *planes);
+
+// True when frame is an 8 bit BGR image and desc a U8 NCHW blob with three
+// channels, the only case the planar fast paths handle.
+bool canWritePlanarU8(const InferenceEngine::TensorDesc &desc, const cv::Mat &frame);
+
+// Resizes a BGR frame straight into image batchIndex of a U8 NCHW input blob.
+// The planes of the blob are filled by cv::split, which is vectorized, so the
+// frame is neither copied to an intermediate planar image nor scattered pixel
+// by pixel as matU8ToBlob does. Any other blob (layout, precision, rank or
+// channels) or frame format goes through matU8ToBlob.
+void frameToPlanarBlob(const cv::Mat &frame, InferenceEngine::Blob::Ptr &blob, int batchIndex = 0);
 
 
 class BaseDetection {
@@ -44,15 +74,38 @@ class BaseDetection {
     int maxSubmittedRequests;
     InferenceEngine::InferencePlugin * plugin;
     int inputRequestIdx;
+    int enquedFrames = 0;
     InferenceEngine::InferRequest::Ptr outputRequest;
     std::vector<InferenceEngine::InferRequest::Ptr> requests;
-    std::queue<InferenceEngine::InferRequest::Ptr> submittedRequests;
     bool auto_resize;
-    bool next_pipe;
     float detection_threshold;
+    bool dynamicBatch = false;  // Requests only run the frames of their batch, see Load::into
+    PreprocessCache *preprocessCache = nullptr;  // Shared with the other detectors, if any
     mutable bool enablingChecked = false;
     mutable bool _enabled = false;
-    FramePipelineFifo S1toS2;
+
+    // A batch of frames travelling between the inference stages together
+    // with the index of the request it was written into.
+    struct InFlightItem {
+        FramePipelineFifoItem item;
+        int requestIdx;
+        long long sequence;  // Submission order, set by the submit stage
+    };
+    typedef dlib::pipe<InFlightItem> InFlightQueue;
+
+    // Posted by the completion callback of a request. The submit stage posts
+    // the ones of the batches that skip inference itself, and a last one with
+    // the number of submitted batches as sequence once its input is closed.
+    struct Completion {
+        int requestIdx;
+        long long sequence;
+        bool last;
+    };
+
+    dlib::pipe<int> freeRequests;        // Requests nobody is reading from or writing to
+    InFlightQueue preprocessed;          // Preprocess -> infer-submit
+    dlib::pipe<Completion> completed;    // Completion callbacks -> infer-collect
+    std::vector<InFlightItem> running;   // Batch being inferred by each request
 
     struct Result {
 	    int batchIndex;
@@ -61,14 +114,26 @@ class BaseDetection {
         cv::Rect location;
     };
 
-    std::vector<Result> results;
+    // Results of the batch being fetched, one list per image of the batch.
+    // The lists keep their capacity from batch to batch.
+    std::vector<std::vector<Result>> results;
+    // Size of each frame of the batch being fetched, by Result::batchIndex.
+    // Frames of different streams may not share a resolution.
+    std::vector<cv::Size> outputFrameSizes;
 
     BaseDetection(std::string &commandLineFlag, std::string &deviceName, std::string topoName, 
                     int maxBatch, int FLAGS_n_async, bool auto_resize, float detection_threshold)
         : commandLineFlag(commandLineFlag), deviceName(deviceName),topoName(topoName), 
             maxBatch(maxBatch), maxSubmittedRequests(FLAGS_n_async), plugin(nullptr), 
             inputRequestIdx(0), outputRequest(nullptr), requests(FLAGS_n_async), 
-            auto_resize(auto_resize), detection_threshold(detection_threshold) {}
+            auto_resize(auto_resize), detection_threshold(detection_threshold),
+            freeRequests(FLAGS_n_async), preprocessed(FLAGS_n_async), completed(FLAGS_n_async + 1),
+            running(FLAGS_n_async) {
+        for (int i = 0; i < FLAGS_n_async; i++) {
+            int idx = i;  // enqueue() swaps the value out
+            this -> freeRequests.enqueue(idx);
+        }
+    }
 
     virtual ~BaseDetection() {}
 
@@ -77,25 +142,31 @@ class BaseDetection {
     }
     virtual InferenceEngine::CNNNetwork read()  = 0;
 
-    virtual void submitRequest();
-
-    // call before wait() to check status
-    bool resultIsReady();
-
-    virtual void wait();
-
     virtual void enqueue(const cv::Mat &frame);
 
     virtual void fetchResults(int inputBatchSize);
 
-    void run_inferrence(FramePipelineFifo *i);
-    void run_inferrence(FramePipelineFifo *i, FramePipelineFifo *o2);
+    // Empties results and makes room for inputBatchSize images
+    void clearResults(int inputBatchSize);
+
+    // Writes frame into image batchIndex of blob, through the preprocessing
+    // cache when the detectors share one
+    void fillInputBlob(const cv::Mat &frame, InferenceEngine::Blob::Ptr &blob, int batchIndex);
 
-    void wait_results(FramePipelineFifo *o);
+    // Creates the infer requests of the loaded network and hooks their
+    // completion callbacks to the collect stage
+    void createRequests();
 
-    bool requestsInProcess();
+    // Pipeline stages. Each one blocks on its input queue and is meant to run
+    // on its own thread; a stage returns once its input has been closed and
+    // closes its own output after it. Requests complete in any order, the
+    // collect stage parses them as they finish and emits frames in order.
+    void preprocess_stage(FramePipelineQueue *in);
+    void submit_stage();
+    void collect_stage(FramePipelineQueue *out);
 
-    bool canSubmitRequest();
+    // Unblocks all stages of this detector without draining them
+    void abort();
 
     bool enabled() const;
     void printPerformanceCounts();
@@ -115,6 +186,8 @@ class Load {
             }
             detector.net = plg.LoadNetwork(detector.read(), config);
             detector.plugin = &plg;
+            detector.dynamicBatch = enable_dynamic_batch;
+            detector.createRequests();
         }
     }
 };
\ No newline at end of file
@@ -0,0 +1,226 @@
+#include "batch_tracker.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "thread_pool.hpp"
+
+const long BatchCorrelationTracker::filter_size;
+const long BatchCorrelationTracker::num_channels;
+const long BatchCorrelationTracker::spectrum_size;
+
+BatchCorrelationTracker::BatchCorrelationTracker(double _regularizer, double _nu)
+	: regularizer(_regularizer), nu(_nu), plan(&dlib::get_fft_plan<float, filter_size, filter_size>())
+{
+	// Same cosine window as dlib::correlation_tracker
+	this->mask.set_size(filter_size, filter_size);
+	const dlib::point cent = dlib::center(dlib::get_rect(this->mask));
+	for (long r = 0; r < filter_size; r++)
+	{
+		for (long c = 0; c < filter_size; c++)
+		{
+			const double dist = std::min(dlib::length(dlib::point(c, r) - cent) / (filter_size / 2.0) * (dlib::pi / 2), dlib::pi / 2);
+			this->mask(r, c) = static_cast<float>(std::cos(dist));
+		}
+	}
+}
+
+int BatchCorrelationTracker::allocate()
+{
+	if (!this->free_slots.empty())
+	{
+		const int slot = this->free_slots.back();
+		this->free_slots.pop_back();
+		return slot;
+	}
+
+	// Grow every array of the arena by one slot
+	const size_t slots = this->state.size() + 1;
+	this->state.resize(slots, FREE);
+	this->position.resize(slots);
+	this->chip_to_img.resize(slots);
+	this->peak.resize(slots);
+	this->psr.resize(slots, 0);
+	this->A.resize(slots * num_channels * spectrum_size);
+	this->B.resize(slots * spectrum_size);
+	this->F.resize(slots * num_channels * spectrum_size);
+	this->G.resize(slots * spectrum_size);
+	return static_cast<int>(slots - 1);
+}
+
+void BatchCorrelationTracker::release(int _slot)
+{
+	if (_slot < 0 || _slot >= static_cast<int>(this->state.size()) || this->state[_slot] == FREE)
+		return;
+	this->state[_slot] = FREE;
+	this->free_slots.push_back(_slot);
+}
+
+void BatchCorrelationTracker::start(int _slot, const dlib::drectangle& _rect)
+{
+	this->state[_slot] = STARTING;
+	this->position[_slot] = _rect;
+	this->psr[_slot] = 0;
+}
+
+void BatchCorrelationTracker::setGuess(int _slot, const dlib::drectangle& _guess)
+{
+	this->position[_slot] = _guess;
+	if (this->state[_slot] == HELD)
+		this->state[_slot] = TRACKING;
+}
+
+void BatchCorrelationTracker::hold(int _slot)
+{
+	if (this->state[_slot] == TRACKING)
+		this->state[_slot] = HELD;
+}
+
+/* ---------------------------------------------------------------------------------
+
+Function : update
+
+Run every stage for all slots before moving to the next one, so each stage walks
+the arena in order and its code and tables stay hot in the cache.
+
+--------------------------------------------------------------------------------- */
+void BatchCorrelationTracker::update(const image_type& _img)
+{
+	std::vector<size_t> slots;
+	for (size_t i = 0; i < this->state.size(); i++)
+		if (this->state[i] == STARTING || this->state[i] == TRACKING)
+			slots.push_back(i);
+	if (slots.empty())
+		return;
+
+	ThreadPool& pool = ThreadPool::shared();
+	pool.parallelFor(0, slots.size(), 1, [&](size_t i) {
+		this->extractFeatures(_img, slots[i]);
+	});
+	pool.parallelFor(0, slots.size(), 1, [&](size_t i) {
+		this->locateTarget(slots[i]);
+	});
+	pool.parallelFor(0, slots.size(), 1, [&](size_t i) {
+		const size_t slot = slots[i];
+		this->updateFilter(slot, this->state[slot] == STARTING ? 1.0f : static_cast<float>(this->nu));
+	});
+
+	for (auto && slot : slots)
+		this->state[slot] = TRACKING;
+}
+
+// Features of the chip around the current position, as dlib::correlation_tracker::make_chip
+void BatchCorrelationTracker::extractFeatures(const image_type& _img, size_t _slot)
+{
+	// Scratch images, one set per pool thread
+	thread_local dlib::array2d<unsigned char> chip;
+	thread_local dlib::array<dlib::array2d<float>> hog;
+	thread_local dlib::matrix<float> buff;
+
+	const double padding = 1.4;
+	const dlib::chip_details details(this->position[_slot] * padding, dlib::chip_dims(filter_size, filter_size));
+	dlib::extract_image_chip(_img, details, chip);
+	this->chip_to_img[_slot] = dlib::inv(dlib::get_mapping_to_chip(details));
+
+	dlib::extract_fhog_features(chip, hog, 1, 3, 3);
+	buff.set_size(filter_size, filter_size);
+	for (long k = 0; k < num_channels; k++)
+	{
+		for (long r = 0; r < filter_size; r++)
+		{
+			for (long c = 0; c < filter_size; c++)
+			{
+				const float v = (k < num_channels - 1) ? hog[k][r][c] : chip[r][c] / 255.0f;
+				buff(r, c) = v * this->mask(r, c);
+			}
+		}
+		// The features are real, only half of their spectrum goes into the arena
+		this->plan->forward_half(&buff(0, 0), this->featureSpectrum(_slot, k));
+	}
+}
+
+// Correlate the filter with the features, find the peak and move the target there
+void BatchCorrelationTracker::locateTarget(size_t _slot)
+{
+	if (this->state[_slot] == STARTING)
+	{
+		// The target is wherever the box put it
+		this->peak[_slot] = dlib::inv(this->chip_to_img[_slot])(dlib::center(this->position[_slot]));
+		this->makeTargetSpectrum(this->peak[_slot], _slot);
+		return;
+	}
+
+	complex_type* g = this->response(_slot);
+	std::fill(g, g + spectrum_size, complex_type(0));
+	for (long k = 0; k < num_channels; k++)
+		dlib::impl::correlate_accumulate(this->featureSpectrum(_slot, k), this->filterSpectrum(_slot, k), g, spectrum_size);
+	dlib::impl::divide_by_energy(g, this->filterEnergy(_slot), static_cast<float>(this->regularizer), spectrum_size);
+
+	thread_local dlib::matrix<float> response_map;
+	response_map.set_size(filter_size, filter_size);
+	this->plan->backward_half(g, &response_map(0, 0));
+	const dlib::dpoint pp = dlib::max_point_interpolated(response_map);
+
+	// Peak to side lobe ratio, the side lobe is everything outside the 8x8 peak area
+	const dlib::point p = pp;
+	const dlib::rectangle peak_area = dlib::centered_rect(p, 8, 8).intersect(dlib::get_rect(response_map));
+	double sum = 0, sum_sqr = 0;
+	dlib::impl::moments(&response_map(0, 0), response_map.size(), sum, sum_sqr);
+	for (long r = peak_area.top(); r <= peak_area.bottom(); r++)
+	{
+		double peak_sum = 0, peak_sum_sqr = 0;
+		dlib::impl::moments(&response_map(r, peak_area.left()), peak_area.width(), peak_sum, peak_sum_sqr);
+		sum -= peak_sum;
+		sum_sqr -= peak_sum_sqr;
+	}
+	const double n = response_map.size() - peak_area.area();
+	const double mean = sum / n;
+	const double stddev = std::sqrt(std::max(0.0, (sum_sqr - n * mean * mean) / (n - 1)));
+	this->psr[_slot] = (response_map(p.y(), p.x()) - mean) / stddev;
+
+	const dlib::drectangle guess = this->position[_slot];
+	this->position[_slot] = dlib::translate_rect(guess, this->chip_to_img[_slot](pp) - dlib::center(guess));
+	this->peak[_slot] = pp;
+	this->makeTargetSpectrum(pp, _slot);
+}
+
+void BatchCorrelationTracker::updateFilter(size_t _slot, float _nu)
+{
+	float* b = this->filterEnergy(_slot);
+	if (this->state[_slot] == STARTING)
+	{
+		// A new target does not inherit anything from the previous user of the slot
+		std::fill(b, b + spectrum_size, 0.0f);
+		std::fill(this->filterSpectrum(_slot, 0), this->filterSpectrum(_slot, 0) + num_channels * spectrum_size, complex_type(0));
+	}
+	else
+	{
+		for (long k = 0; k < spectrum_size; k++)
+			b[k] *= 1 - _nu;
+	}
+
+	const complex_type* g = this->response(_slot);
+	for (long k = 0; k < num_channels; k++)
+		dlib::impl::update_filter(g, this->featureSpectrum(_slot, k), this->filterSpectrum(_slot, k), b, _nu, spectrum_size);
+}
+
+void BatchCorrelationTracker::makeTargetSpectrum(const dlib::dpoint& _p, size_t _slot)
+{
+	thread_local dlib::matrix<float> buff;
+	buff.set_size(filter_size, filter_size);
+	buff = 0;
+	const dlib::rectangle area = dlib::centered_rect(_p, 21, 21).intersect(dlib::get_rect(buff));
+	for (long r = area.top(); r <= area.bottom(); r++)
+	{
+		for (long c = area.left(); c <= area.right(); c++)
+		{
+			const double dist = dlib::length(dlib::point(c, r) - _p);
+			buff(r, c) = static_cast<float>(std::exp(-dist / 3.0));
+		}
+	}
+
+	complex_type* g = this->response(_slot);
+	this->plan->forward_half(&buff(0, 0), g);
+	for (long k = 0; k < spectrum_size; k++)
+		g[k] = std::conj(g[k]);
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <complex>
+#include <vector>
+
+#include <dlib/image_processing.h>
+#include <dlib/opencv.h>
+
+/* ==========================================================================
+
+Class : BatchCorrelationTracker
+
+Correlation trackers of every target of a camera, stored as structure of arrays.
+The filter spectra (A, B) of all targets live in one contiguous arena, slot
+after slot, and so do the per-frame feature spectra (F) and responses (G).
+A frame is processed stage by stage for all targets at once (features and
+FFT, correlation, peak search, model update), each stage a flat loop over
+the arena split across the shared ThreadPool.
+
+It is the same tracker as dlib::correlation_tracker_float::update_noscale(),
+with the default filter_size of 64 and no scale estimation.
+
+A target is a slot index: allocate() a slot, start() it on a box and read
+its position back after every update().
+
+========================================================================== */
+class BatchCorrelationTracker
+{
+public:
+	typedef dlib::cv_image<unsigned char> image_type;
+	typedef std::complex<float> complex_type;
+
+	static const long filter_size = 64;
+	static const long num_channels = 32;				// 31 HOG channels + intensity
+	static const long spectrum_size = filter_size * (filter_size / 2 + 1);	// Half spectra, the features are real
+
+	explicit BatchCorrelationTracker(double _regularizer = 0.001, double _nu = 0.025);
+
+	/* Slot Management */
+	// Returns a free slot, reusing released ones before growing the arena
+	int	allocate();
+	void	release(int _slot);
+
+	/* Core Function */
+	// (Re)initialize the slot on _rect during the next update()
+	void	start(int _slot, const dlib::drectangle& _rect);
+
+	// Search around _guess during the next update(), the default is the current position
+	void	setGuess(int _slot, const dlib::drectangle& _guess);
+
+	// Leave a tracking slot out of the next update(), keeping its filter. start() or setGuess() bring it back
+	void	hold(int _slot);
+
+	// Track every started slot on _img
+	void	update(const image_type& _img);
+
+	/* Get Function */
+	dlib::drectangle	getPosition(int _slot) const { return this->position[_slot]; }
+	double			getPSR(int _slot) const { return this->psr[_slot]; }
+	bool			isTracking(int _slot) const { return this->state[_slot] == TRACKING || this->state[_slot] == HELD; }
+	size_t			getCapacity() const { return this->state.size(); }
+
+private:
+	enum SlotState { FREE, STARTING, TRACKING, HELD };
+
+	// Pointers into the arena
+	complex_type*	filterSpectrum(size_t _slot, long _channel) { return &this->A[(_slot * num_channels + _channel) * spectrum_size]; }
+	complex_type*	featureSpectrum(size_t _slot, long _channel) { return &this->F[(_slot * num_channels + _channel) * spectrum_size]; }
+	float*		filterEnergy(size_t _slot) { return &this->B[_slot * spectrum_size]; }
+	complex_type*	response(size_t _slot) { return &this->G[_slot * spectrum_size]; }
+
+	/* Stages, each one runs for a single slot */
+	void	extractFeatures(const image_type& _img, size_t _slot);
+	void	locateTarget(size_t _slot);
+	void	updateFilter(size_t _slot, float _nu);
+
+	// Writes the conjugated half spectrum of a gaussian peak at _p into the response of _slot
+	void	makeTargetSpectrum(const dlib::dpoint& _p, size_t _slot);
+
+	double	regularizer;
+	double	nu;
+	const dlib::fft_plan<float>*	plan;			// Shared 64x64 transform
+	dlib::matrix<float>	mask;				// Cosine window of the feature chips
+
+	/* Per slot state */
+	std::vector<unsigned char>		state;
+	std::vector<dlib::drectangle>		position;	// Guess before update(), result after
+	std::vector<dlib::point_transform_affine> chip_to_img;	// Mapping of the last feature chip
+	std::vector<dlib::dpoint>		peak;		// Sub-pixel peak of the last response, chip coordinates
+	std::vector<double>			psr;		// Peak to side lobe ratio of the last update
+	std::vector<int>			free_slots;
+
+	/* Arena */
+	std::vector<complex_type>	A;			// Filter numerators, num_channels spectra per slot
+	std::vector<float>		B;			// Filter denominators, one per slot
+	std::vector<complex_type>	F;			// Feature spectra of the current frame
+	std::vector<complex_type>	G;			// Response, then target spectrum, of the current frame
+};
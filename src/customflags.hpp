@@ -32,7 +32,7 @@
 static const char help_message[] = "Print a usage message.";
 
 /// @brief message for images argument
-static const char video_message[] = "Optional. Path to an video file. Default value is \"cam\" to work with camera.";
+static const char video_message[] = "Optional. Comma separated list of video files, stream URLs or cameras (\"cam\" or \"cam:N\"), all processed by the same detectors. Default value is \"cam\" to work with camera.";
 
 /// @brief message for model argument
 static const char vehicle_detection_model_message[] = "Optional. Path to the Vehicle (.xml) file.";
@@ -72,12 +72,29 @@ static const char custom_cpu_library_message[] = "For MKLDNN (CPU)-targeted cust
 /// @brief message for probability threshold argument
 static const char thresh_output_message[] = "Probability threshold for vehicle/licence-plate detections.";
 
+/// @brief message per label probability threshold flag
+static const char thresh_label_message[] = "Probability thresholds of some labels of the vehicle detections (-m), as label:threshold pairs, "
+                                           "e.g. \"1:0.6,2:0.3\". The other labels use -t.";
+
+/// @brief message per label probability threshold flag of the pedestrians model
+static const char thresh_label_p_message[] = "Same as -t_label, in the label space of the pedestrians detection model (-m_p).";
+
+/// @brief message per label probability threshold flag of the vehicle and pedestrian model
+static const char thresh_label_vp_message[] = "Same as -t_label, in the label space of the vehicle and pedestrian detection model (-m_vp).";
+
 /// @brief message raw output flag
 static const char raw_output_message[] = "Output Inference results as raw values.";
 
 /// @brief message async function flag
 static const char async_depth_message[] = "Maximum number of outstanding async API calls allowed (1=synchronous=default, >1=asynchronous).";
 
+/// @brief message dynamic batching flag
+static const char dyn_batch_message[] = "Enable dynamic batching, a partial batch only infers the frames it holds (CPU and GPU only, default is 0).";
+
+/// @brief message batch deadline flag
+static const char batch_wait_message[] = "Maximum time in ms a frame waits for its inference batch to fill up before a partial batch is sent "
+                                         "(0 = wait for a full batch, default).";
+
 /// @brief message no wait for keypress after input stream completed
 static const char no_wait_for_keypress_message[] = "No wait for key press in the end.";
 
@@ -92,6 +109,42 @@ static const char run_yolo[] = "Running Yolo v3 as detector.";
 
 static const char intersection_over_union_yolo[] = "Intersection over Yolo ROI threshold";
 
+/// @brief message for the NMS method of the Yolo boxes
+static const char nms_message[] = "Filtering of the overlapping Yolo boxes of a class: hard (default), linear or gaussian (soft NMS, "
+                                  "the scores of the overlapping boxes decay instead of being dropped).";
+
+/// @brief message for the interval between two runs of the detectors
+static const char detect_interval_message[] = "With -tracking, most frames between two runs of the detectors, the trackers carry the targets "
+                                              "in between. The interval adapts to new objects, tracker confidence and motion (default 5).";
+
+/// @brief message for the size of the tracking thread pool
+static const char tracking_threads_message[] = "Number of threads of the tracking pool shared by all cameras (0 = one per hardware thread, default).";
+
+/// @brief message for pinning the tracking thread pool
+static const char tracking_cpus_message[] = "Comma separated list of CPUs the tracking threads are pinned to, e.g. \"4,5,6,7\". "
+                                            "Keep them apart from the CPUs used by the inference plugin.";
+
+/// @brief message for tracking on cropped search windows
+static const char tracking_roi_message[] = "Update every tracker on a grayscale crop around its target instead of converting the whole frame.";
+
+/// @brief message for the single precision tracker
+static const char tracking_float_message[] = "Use the single precision, SIMD vectorized correlation tracker.";
+
+/// @brief message for batched tracking
+static const char tracking_batch_message[] = "Track all targets together, with their filters in one contiguous arena (single precision, overrides -tracking_roi).";
+
+/// @brief message for scheduling the scale estimation of the trackers
+static const char tracking_scale_message[] = "Scale estimation of the trackers: off (default), adaptive (when the PSR drops, "
+                                             "while the box size changes and every -tracking_scale_interval frames) or always. "
+                                             "Not available with -tracking_batch.";
+
+/// @brief message for the interval of the adaptive scale estimation
+static const char tracking_scale_interval_message[] = "Frames between two scale estimations of a target at most, with -tracking_scale adaptive (default 10).";
+
+/// @brief message for coasting the cheap targets on their motion model
+static const char tracking_coast_message[] = "Small, slow or steadily tracked targets skip the correlation update and move with their "
+                                             "motion model for up to this many frames in a row (default 0, never).";
+
 /// \brief Define flag for showing help message <br>
 DEFINE_bool(h, false, help_message);
 
@@ -131,6 +184,18 @@ DEFINE_bool(r, false, raw_output_message);
 /// It is an optional parameter
 DEFINE_double(t, 0.5, thresh_output_message);
 
+/// \brief Probability thresholds of single labels<br>
+/// It is an optional parameter
+DEFINE_string(t_label, "", thresh_label_message);
+
+/// \brief Probability thresholds of single labels of the pedestrians model<br>
+/// It is an optional parameter
+DEFINE_string(t_label_p, "", thresh_label_p_message);
+
+/// \brief Probability thresholds of single labels of the vehicle and pedestrian model<br>
+/// It is an optional parameter
+DEFINE_string(t_label_vp, "", thresh_label_vp_message);
+
 /// \brief Flag to disable keypress exit<br>
 /// It is an optional parameter
 DEFINE_bool(no_wait, false, no_wait_for_keypress_message);
@@ -143,6 +208,14 @@ DEFINE_bool(no_show, false, no_show_processed_video);
 /// It is an optional parameter
 DEFINE_uint32(n_async, 1, async_depth_message);
 
+/// \brief parameter to set the deadline of partial inference batches <br>
+/// It is an optional parameter
+DEFINE_uint32(batch_wait, 0, batch_wait_message);
+
+/// \brief Enable dynamic batching of the detection networks<br>
+/// It is an optional parameter
+DEFINE_bool(dyn_batch, false, dyn_batch_message);
+
 ///
 
 DEFINE_bool(show_selection, false, show_interest_areas_selection);
@@ -157,6 +230,17 @@ DEFINE_string(m_y, "", yolo_model_message);
 DEFINE_uint32(n_y, 1, num_batch_message);
 DEFINE_string(d_y, "CPU", target_device_message_yolo);
 DEFINE_double(iou_t, 0.4, intersection_over_union_yolo);
+DEFINE_string(nms, "hard", nms_message);
+
+DEFINE_uint32(detect_interval, 5, detect_interval_message);
+DEFINE_uint32(tracking_threads, 0, tracking_threads_message);
+DEFINE_string(tracking_cpus, "", tracking_cpus_message);
+DEFINE_bool(tracking_roi, false, tracking_roi_message);
+DEFINE_bool(tracking_float, false, tracking_float_message);
+DEFINE_bool(tracking_batch, false, tracking_batch_message);
+DEFINE_string(tracking_scale, "off", tracking_scale_message);
+DEFINE_uint32(tracking_scale_interval, 10, tracking_scale_interval_message);
+DEFINE_uint32(tracking_coast, 0, tracking_coast_message);
 
 DEFINE_string(m_vp, "", vp_model_message);
 DEFINE_uint32(n_vp, 1, num_batch_message);
@@ -189,6 +273,8 @@ static void showUsage() {
     std::cout << "    -n_vp \"<num>\"            " << num_batch_va_message << std::endl;
     std::cout << "    -dyn_va                    " << dyn_va_message << std::endl;
     std::cout << "    -n_aysnc \"<num>\"         " << async_depth_message << std::endl;
+    std::cout << "    -batch_wait \"<ms>\"       " << batch_wait_message << std::endl;
+    std::cout << "    -dyn_batch                 " << dyn_batch_message << std::endl;
     std::cout << "    -auto_resize               " << auto_resize_message << std::endl;
     std::cout << "    -no_wait                   " << no_wait_for_keypress_message << std::endl;
     std::cout << "    -no_show                   " << no_show_processed_video << std::endl;
@@ -196,7 +282,20 @@ static void showUsage() {
     std::cout << "    -tracking         	     " << do_tracking << std::endl;
     std::cout << "    -yolo         	         " << run_yolo << std::endl;
     std::cout << "    -iou_t         	         " << intersection_over_union_yolo << std::endl;
+    std::cout << "    -nms \"<method>\"          " << nms_message << std::endl;
+    std::cout << "    -detect_interval \"<num>\"   " << detect_interval_message << std::endl;
+    std::cout << "    -tracking_threads \"<num>\"  " << tracking_threads_message << std::endl;
+    std::cout << "    -tracking_cpus \"<list>\"    " << tracking_cpus_message << std::endl;
+    std::cout << "    -tracking_roi              " << tracking_roi_message << std::endl;
+    std::cout << "    -tracking_float            " << tracking_float_message << std::endl;
+    std::cout << "    -tracking_batch            " << tracking_batch_message << std::endl;
+    std::cout << "    -tracking_scale \"<mode>\"    " << tracking_scale_message << std::endl;
+    std::cout << "    -tracking_scale_interval \"<num>\" " << tracking_scale_interval_message << std::endl;
+    std::cout << "    -tracking_coast \"<num>\"     " << tracking_coast_message << std::endl;
     std::cout << "    -pc                        " << performance_counter_message << std::endl;
     std::cout << "    -r                         " << raw_output_message << std::endl;
     std::cout << "    -t                         " << thresh_output_message << std::endl;
+    std::cout << "    -t_label \"<list>\"        " << thresh_label_message << std::endl;
+    std::cout << "    -t_label_p \"<list>\"      " << thresh_label_p_message << std::endl;
+    std::cout << "    -t_label_vp \"<list>\"     " << thresh_label_vp_message << std::endl;
 }
@@ -0,0 +1,60 @@
+#include "detection_scheduler.hpp"
+
+#include <algorithm>
+
+DetectionScheduler::DetectionScheduler(unsigned maxInterval, unsigned minInterval)
+	: min_interval(std::max(1u, minInterval)), max_interval(std::max(std::max(1u, minInterval), maxInterval)),
+	interval(min_interval), until_key(0), force_key(false), decoded(0), tracked(0), quiet_until(0)
+{
+}
+
+bool DetectionScheduler::nextIsKeyFrame()
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+	const unsigned long long frame = this->decoded++;
+	if (this->force_key || this->until_key == 0)
+	{
+		if (this->force_key)
+			this->quiet_until = frame;
+		this->force_key = false;
+		this->until_key = this->interval - 1;
+		return true;
+	}
+	this->until_key--;
+	return false;
+}
+
+void DetectionScheduler::keyFrameDone(int newObjects)
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+	if (newObjects > 0)
+		this->shorten();
+	else
+		this->interval = std::min(this->max_interval, this->interval + 1);
+}
+
+void DetectionScheduler::frameTracked(double minPsr, double activity)
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+	// Once per event, the frames decoded before the forced key frame report it too
+	const unsigned long long frame = this->tracked++;
+	if (this->force_key || frame < this->quiet_until)
+		return;
+	if (minPsr < this->lowPsr || activity > this->highActivity)
+	{
+		this->shorten();
+		this->force_key = true;
+	}
+}
+
+unsigned DetectionScheduler::getInterval()
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+	return this->interval;
+}
+
+void DetectionScheduler::shorten()
+{
+	this->interval = std::max(this->min_interval, this->interval / 2);
+	this->until_key = std::min(this->until_key, this->interval - 1);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <mutex>
+
+/* ==========================================================================
+
+Class : DetectionScheduler
+
+Decides which frames go through the detectors (the key frames). The
+tracking system carries the targets over the frames in between.
+
+The interval between two key frames adapts to the scene, growing by one
+frame after every quiet key frame and halving when something happens:
+ - new objects showed up in the detections of a key frame,
+ - a tracker lost confidence (its PSR fell under lowPsr), or
+ - the targets move fast (more than highActivity of their size per frame).
+The last two also make the very next frame a key frame.
+
+The decode stage asks nextIsKeyFrame() for every frame, the tracking stage
+reports back, so both sides may run on different threads. The decode side
+runs a pipeline depth ahead: the frames decoded before a forced key frame
+would report the event that forced it again, so their reports are ignored.
+
+========================================================================== */
+class DetectionScheduler
+{
+public:
+	// maxInterval of 1 makes every frame a key frame
+	explicit DetectionScheduler(unsigned maxInterval = 1, unsigned minInterval = 1);
+
+	/* Decode side */
+	bool	nextIsKeyFrame();
+
+	/* Tracking side */
+	// After the detections of a key frame went to the tracking system
+	void	keyFrameDone(int newObjects);
+	// After every tracked frame, in decode order, with the lowest PSR of the
+	// trackers and their mean displacement in one frame relative to their size
+	void	frameTracked(double minPsr, double activity);
+
+	unsigned	getInterval();
+
+	double	lowPsr = 7.0;
+	double	highActivity = 0.25;
+
+private:
+	void	shorten();
+
+	const unsigned	min_interval;
+	const unsigned	max_interval;
+
+	std::mutex	lock;
+	unsigned	interval;
+	unsigned	until_key;	// Frames to skip before the next key frame
+	bool		force_key;
+	unsigned long long	decoded;	// Frames handed out by nextIsKeyFrame()
+	unsigned long long	tracked;	// Frames reported by frameTracked()
+	unsigned long long	quiet_until;	// Reports of the frames decoded before this one are ignored
+};
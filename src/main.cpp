@@ -27,19 +27,33 @@
 #include <memory>
 #include <chrono>
 #include <algorithm>
+#include <cmath>
 #include <iterator>
+#include <limits>
 #include <map>
 #include <string>
 #include <vector>
 #include <queue>
 #include <utility>
+#include <thread>
+#include <atomic>
+#include <exception>
+#include <mutex>
 #include <stdlib.h> 
+#ifdef __linux__
+#include <sched.h>
+#endif
 
 #include <opencv2/opencv.hpp>
 #include "customflags.hpp"
 #include "drawer.hpp"
 
 #include "Tracker.h"
+#include "detection_scheduler.hpp"
+#include "preprocess_cache.hpp"
+#include "stream_batcher.hpp"
+#include "stream_manager.hpp"
+#include "thread_pool.hpp"
 #include "object_detection.hpp"
 #include "yolo_detection.hpp"
 #include "yolo_labels.hpp"
@@ -67,15 +81,89 @@ bool ParseAndCheckCommandLine(int argc, char *argv[]) {
 	    FLAGS_n = 1;
 	    FLAGS_n_p = 1;
 	    FLAGS_n_y = 1;
+	    FLAGS_n_vp = 1;
     }
 
     if (FLAGS_n_async < 1) {
         throw std::invalid_argument("Parameter -n_async must be >= 1");
     }
 
+    if (FLAGS_nms != "hard" && FLAGS_nms != "linear" && FLAGS_nms != "gaussian") {
+        throw std::invalid_argument("Parameter -nms must be hard, linear or gaussian");
+    }
+
+    if (FLAGS_tracking_scale != "off" && FLAGS_tracking_scale != "adaptive" && FLAGS_tracking_scale != "always") {
+        throw std::invalid_argument("Parameter -tracking_scale must be off, adaptive or always");
+    }
+
+    if (FLAGS_detect_interval < 1) {
+        throw std::invalid_argument("Parameter -detect_interval must be >= 1");
+    }
+
+    if (FLAGS_tracking_scale_interval < 1) {
+        throw std::invalid_argument("Parameter -tracking_scale_interval must be >= 1");
+    }
+
     return true;
 }
 
+// Parses a comma separated list of CPU indexes such as "4,5,6,7", every one
+// of them must be a CPU this process is allowed to run on
+std::vector<int> ParseCpuList(const std::string &list) {
+    std::vector<int> cpus;
+    std::stringstream ss(list);
+    std::string item;
+#ifdef __linux__
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        throw std::runtime_error("Cannot read the CPU affinity of the process for -tracking_cpus");
+    }
+#endif
+    while (std::getline(ss, item, ',')) {
+        if (item.empty()) {
+            continue;
+        }
+        const int cpu = std::stoi(item);
+#ifdef __linux__
+        if (cpu < 0 || cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &allowed)) {
+#else
+        if (cpu < 0) {
+#endif
+            throw std::invalid_argument("Parameter -tracking_cpus: CPU " + item + " is not available to this process");
+        }
+        cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+// Parses comma separated label:threshold pairs such as "1:0.6,2:0.3" into a
+// threshold per label, -1 for the labels that are not listed. flag names the
+// parameter in the error messages
+std::vector<float> ParseLabelThresholds(const std::string &list, const std::string &flag) {
+    std::vector<float> thresholds;
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (item.empty()) {
+            continue;
+        }
+        const size_t colon = item.find(':');
+        if (colon == std::string::npos) {
+            throw std::invalid_argument("Parameter " + flag + " expects label:threshold pairs, got " + item);
+        }
+        const int label = std::stoi(item.substr(0, colon));
+        if (label < 0) {
+            throw std::invalid_argument("Parameter " + flag + " expects non negative labels, got " + item);
+        }
+        if (label >= static_cast<int>(thresholds.size())) {
+            thresholds.resize(label + 1, -1.0f);
+        }
+        thresholds[label] = std::stof(item.substr(colon + 1));
+    }
+    return thresholds;
+}
+
 // -------------------------Generic routines for detection networks-------------------------------------------------
 
 int main(int argc, char *argv[]) {
@@ -88,14 +176,8 @@ int main(int argc, char *argv[]) {
             return 0;
         }
 
-        // -----------------------------Read input -----------------------------------------------------
-        slog::info << "Reading input" << slog::endl;
-        cv::VideoCapture cap;
-        if (!(FLAGS_i == "cam" ? cap.open(0) : cap.open(FLAGS_i))) {
-            throw std::invalid_argument("Cannot open input file or camera: " + FLAGS_i);
-        }
-        //const size_t width  = (size_t) cap.get(cv::CAP_PROP_FRAME_WIDTH);
-        //const size_t height = (size_t) cap.get(cv::CAP_PROP_FRAME_HEIGHT);
+        // Tracking threads are created once and shared by every camera of the process
+        ThreadPool::configureShared(FLAGS_tracking_threads, ParseCpuList(FLAGS_tracking_cpus));
 
         // ---------------------Load plugins for inference engine------------------------------------------------
         std::map<std::string, InferenceEngine::InferencePlugin> pluginsForDevices;
@@ -108,25 +190,19 @@ int main(int argc, char *argv[]) {
                 << (runningAsync ? "asynchronously" : "synchronously")
                 << slog::endl;
 
-        FramePipelineFifo pipeS0Fifo;
-        FramePipelineFifo pipeS0Fifo2;
-        FramePipelineFifo pipeS0toS1Fifo;
-        FramePipelineFifo pipeS0toS2Fifo;
-        FramePipelineFifo pipeS1toS2Fifo;
-        FramePipelineFifo pipeS2toS3Fifo;
-        FramePipelineFifo pipeS3toS4Fifo;
-        FramePipelineFifo pipeS1toS4Fifo;
-
-        //Yolo lane FIFOs
-        FramePipelineFifo pipeS0ytoS1yFifo;
-        FramePipelineFifo pipeS1ytoS4Fifo;
-
-        FramePipelineFifo news0tos1;
-
         ObjectDetection VehicleDetection(FLAGS_m, FLAGS_d, "Vehicle Detection", FLAGS_n, FLAGS_n_async, FLAGS_auto_resize, FLAGS_t);
         ObjectDetection PedestriansDetection(FLAGS_m_p, FLAGS_d_p, "Pedestrians Detection", FLAGS_n_p, FLAGS_n_async, FLAGS_auto_resize, FLAGS_t);
         ObjectDetection VPDetection(FLAGS_m_vp, FLAGS_d_vp, "Pedestrians Detection", FLAGS_n_vp, FLAGS_n_async, FLAGS_auto_resize, FLAGS_t);
+        // every model has its own label space, so its own thresholds
+        VehicleDetection.labelThresholds = ParseLabelThresholds(FLAGS_t_label, "-t_label");
+        PedestriansDetection.labelThresholds = ParseLabelThresholds(FLAGS_t_label_p, "-t_label_p");
+        VPDetection.labelThresholds = ParseLabelThresholds(FLAGS_t_label_vp, "-t_label_vp");
         YoloDetection   GeneralDetection(FLAGS_m_y, FLAGS_d_y, "Yolo Detection", FLAGS_n_y, FLAGS_n_async, FLAGS_auto_resize, FLAGS_t, FLAGS_iou_t);    
+        if (FLAGS_nms == "linear") {
+            GeneralDetection.nms.method = NmsParams::LINEAR;
+        } else if (FLAGS_nms == "gaussian") {
+            GeneralDetection.nms.method = NmsParams::GAUSSIAN;
+        }
 
         const bool yolo_enabled = GeneralDetection.enabled();
         const bool vp_enabled = (VehicleDetection.enabled() && PedestriansDetection.enabled());
@@ -174,35 +250,52 @@ int main(int argc, char *argv[]) {
         }
 
         // --------------------Load networks (Generated xml/bin files)-------------------------------------------
-        Load(VehicleDetection).into(pluginsForDevices[FLAGS_d], false);
-        Load(PedestriansDetection).into(pluginsForDevices[FLAGS_d_p], false);
-        Load(GeneralDetection).into(pluginsForDevices[FLAGS_d_y], false);
-        Load(VPDetection).into(pluginsForDevices[FLAGS_d_vp], false);
-
+        Load(VehicleDetection).into(pluginsForDevices[FLAGS_d], FLAGS_dyn_batch);
+        Load(PedestriansDetection).into(pluginsForDevices[FLAGS_d_p], FLAGS_dyn_batch);
+        Load(GeneralDetection).into(pluginsForDevices[FLAGS_d_y], FLAGS_dyn_batch);
+        Load(VPDetection).into(pluginsForDevices[FLAGS_d_vp], FLAGS_dyn_batch);
+
+
+        // Every lane gets the same batches, so they can not be bigger than the
+        //  smallest batch of the running networks
+        int laneBatch = 0;
+        for (auto && detector : std::vector<BaseDetection*>{&VehicleDetection, &PedestriansDetection, &GeneralDetection, &VPDetection}) {
+            if (detector->enabled() && (laneBatch == 0 || detector->maxBatch < laneBatch)) {
+                laneBatch = detector->maxBatch;
+            }
+        }
+        laneBatch = std::max(1, laneBatch);
 
         // read input (video) frames, need to keep multiple frames stored
-        //  for batching and for when using asynchronous API.
-        const int maxNumInputFrames = FLAGS_n_async * VehicleDetection.maxBatch + 1;  // +1 to avoid overwrite
-        cv::Mat* inputFrames = new cv::Mat[maxNumInputFrames];
-        std::queue<cv::Mat*> inputFramePtrs;
-        for(int fi = 0; fi < maxNumInputFrames; fi++) {
-            inputFramePtrs.push(&inputFrames[fi]);
-        }
-		//-----------------------Define regions of interest-----------------------------------------------------
-            RegionsOfInterest scene;
+        //  for batching, for when using asynchronous API and for every
+        //  pipeline stage working on its own frame at the same time.
+        //  Every stream gets enough of them to fill the pipeline alone.
+        const int pipelineDepth = 2;  // capacity of the queues joining the pipeline stages
+        const int maxNumInputFrames = (FLAGS_n_async + pipelineDepth + 1) * laneBatch
+                                        + 3 * pipelineDepth + 1;
 
-    		cap.read(scene.orig);
-    		// Do deep copy to preserve original frame
-    		scene.out = scene.orig.clone();
-            // Add check
+        // -----------------------------Read input -----------------------------------------------------
+        slog::info << "Reading input" << slog::endl;
+        // Without tracking the detections are all there is, so every frame is a key frame
+        StreamManager streams(StreamManager::parseSources(FLAGS_i), maxNumInputFrames, FLAGS_tracking ? FLAGS_detect_interval : 1);
+        slog::info << streams.size() << " input stream(s)" << slog::endl;
+        auto windowName = [&](int streamId) {
+            return streams.size() == 1 ? std::string("Detection results")
+                                       : "Detection results [" + streams[streamId].source + "]";
+        };
+
+		//-----------------------Define regions of interest-----------------------------------------------------
         if (FLAGS_show_selection){
-            cv::namedWindow("ImageDisplay",1);
-            cv::setMouseCallback("ImageDisplay", CallBackFunc, &scene);
-    		DrawAreasOfInterest(&scene);
-    		cv::destroyWindow("ImageDisplay");
-    		cv::namedWindow("Result",1);
-    		cv::imshow("Result", scene.out);
-    		cv::waitKey();
+            for (size_t si = 0; si < streams.size(); si++) {
+                RegionsOfInterest &scene = streams[si].scene;
+                cv::namedWindow("ImageDisplay",1);
+                cv::setMouseCallback("ImageDisplay", CallBackFunc, &scene);
+                DrawAreasOfInterest(&scene);
+                cv::destroyWindow("ImageDisplay");
+                cv::namedWindow("Result",1);
+                cv::imshow("Result", scene.out);
+                cv::waitKey();
+            }
         }
         
         // ----------------------------Do inference-------------------------------------------------------------
@@ -211,108 +304,144 @@ int main(int argc, char *argv[]) {
         std::chrono::high_resolution_clock::time_point wallclockStart;
 		std::chrono::high_resolution_clock::time_point wallclockEnd;
 
-        bool firstFrame = true;
-        bool firstFrameWithDetections = true;
-        bool haveMoreFrames = true;
-        bool done = false;
-        int numFrames = 0;
-        int numSyncFrames = 0;
-        int totalFrames = 0;
-        double ocv_decode_time_vehicle = 0;
-		double ocv_decode_time_pedestrians = 0;
-		double ocv_render_time = 0;
-        cv::Mat* lastOutputFrame;
-        std::vector<std::pair<cv::Rect, int>> firstResults;
-        const int update_frame = 5;
-        int update_counter = 0;
-        std::string last_event;
-        TrackingSystem tracking_system(&last_event);
-
-        // structure to hold frame and associated data which are passed along
-        //  from stage to stage for each to do its work
-        
-        // Queues to pass information across pipeline stages
-
-        wallclockStart = std::chrono::high_resolution_clock::now();
-        /** Start inference & calc performance **/
-        do {
-            std::chrono::high_resolution_clock::time_point a = std::chrono::high_resolution_clock::now();
-            std::chrono::high_resolution_clock::time_point b = std::chrono::high_resolution_clock::now();
-            ms detection_time;
-            detection_time = std::chrono::duration_cast<ms>(b -a);
-            std::chrono::high_resolution_clock::time_point t0;
-			std::chrono::high_resolution_clock::time_point t1;
-            //------------------------------------------------------------------------------------
-            //------------------- Frame Read Stage -----------------------------------------------
-            //------------------------------------------------------------------------------------
-            if (haveMoreFrames && (inputFramePtrs.size() >= VehicleDetection.maxBatch)) {
-                FramePipelineFifoItem ps0;
-                for(numFrames = 0; numFrames < VehicleDetection.maxBatch; numFrames++) {
-                    // read in a frame
-					cv::Mat* curFrame = &scene.orig;
-                    if (totalFrames > 0) {
-					   curFrame = inputFramePtrs.front();
-					   inputFramePtrs.pop();
-                       haveMoreFrames = cap.read(*curFrame);
-					}
-                    if (!haveMoreFrames) {
-                        break;
-                    }
-                    totalFrames++;
-                    ps0.batchOfInputFrames.push_back(curFrame);
-                    if (firstFrame && !FLAGS_no_show) {
-                        slog::info << "Press 's' key to save a snapshot, press any other key to stop" << slog::endl;
-                    }
+        std::atomic<bool> stopRequested(false);
+        std::atomic<int> totalFrames(0);
+        double ocv_render_time = 0;
+        cv::Mat lastOutputFrame;
+        ScaleSchedule scale_schedule;
+        if (FLAGS_tracking_scale == "adaptive")
+            scale_schedule.mode = ScaleSchedule::ADAPTIVE;
+        else if (FLAGS_tracking_scale == "always")
+            scale_schedule.mode = ScaleSchedule::ALWAYS;
+        scale_schedule.interval = FLAGS_tracking_scale_interval;
+        CoastPolicy coast_policy;
+        coast_policy.interval = FLAGS_tracking_coast;
+        for (size_t si = 0; si < streams.size(); si++) {
+            TrackingSystem &tracking_system = streams[si].tracking_system;
+            tracking_system.setRoiTracking(FLAGS_tracking_roi);
+            tracking_system.setFloatTracking(FLAGS_tracking_float);
+            tracking_system.setBatchTracking(FLAGS_tracking_batch);
+            tracking_system.setScaleSchedule(scale_schedule);
+            tracking_system.setCoastPolicy(coast_policy);
+        }
 
-                    firstFrame = false;
-                }
-                pipeS0Fifo.push(ps0);
+        // Pipeline: decode (per stream) -> (preprocess -> infer-submit -> infer-collect) per detector -> track -> render.
+        // Every stage runs on its own thread, except rendering which stays on the main
+        // thread as HighGUI expects. All streams share the detectors and their batches.
+        // Stages are joined by bounded queues, so decoding frame N+1 overlaps inference
+        // of frame N and tracking of frame N-1.
+        FramePipelineQueue vehicleInput(pipelineDepth);
+        FramePipelineQueue pedestriansInput(pipelineDepth);
+        FramePipelineQueue vpInput(pipelineDepth);
+        FramePipelineQueue yoloInput(pipelineDepth);
+        FramePipelineQueue vehicleResults(pipelineDepth);
+        FramePipelineQueue pedestriansResults(pipelineDepth);
+        FramePipelineQueue vpResults(pipelineDepth);
+        FramePipelineQueue yoloResults(pipelineDepth);
+        FramePipelineQueue renderQueue(pipelineDepth);
+
+        std::vector<FramePipelineQueue*> laneInputs;   // decode stage fans frames out to these
+        std::vector<FramePipelineQueue*> laneOutputs;
+        std::vector<BaseDetection*> runningDetectors;
+        std::vector<std::thread> stages;
+
+        // Detectors running side by side resize and convert each frame only once per input format
+        const int numLanes = (vp_enabled ? 2 : 0) + (vp2_enabled ? 1 : 0) + (yolo_enabled ? 1 : 0);
+        PreprocessCache preprocessCache(numLanes);
+
+        // Lanes are only started once all of them are known, abortPipeline reads runningDetectors
+        auto addDetector = [&](BaseDetection &detector, FramePipelineQueue *in, FramePipelineQueue *out) {
+            if (numLanes > 1) {
+                detector.preprocessCache = &preprocessCache;
             }
+            laneInputs.push_back(in);
+            laneOutputs.push_back(out);
+            runningDetectors.push_back(&detector);
+        };
 
-            if(vp_enabled){
-                VehicleDetection.run_inferrence(&pipeS0Fifo, &pipeS1toS2Fifo);
-                VehicleDetection.wait_results(&pipeS1toS4Fifo);
-                PedestriansDetection.run_inferrence(&pipeS1toS2Fifo);
-                PedestriansDetection.wait_results(&pipeS3toS4Fifo);
+        // Unblocks every stage without draining, used when a stage fails
+        auto abortPipeline = [&]() {
+            stopRequested = true;
+            streams.abort();
+            for (auto && queue : {&vehicleInput, &pedestriansInput, &vpInput, &yoloInput, &vehicleResults,
+                                  &pedestriansResults, &vpResults, &yoloResults, &renderQueue}) {
+                queue->disable();
             }
-
-            if(vp2_enabled){
-                VPDetection.run_inferrence(&pipeS0Fifo);
-                VPDetection.wait_results(&pipeS1ytoS4Fifo);
+            for (auto && detector : runningDetectors) {
+                detector->abort();
             }
+        };
 
-            if(yolo_enabled){
-                GeneralDetection.run_inferrence(&pipeS0Fifo);
-                GeneralDetection.wait_results(&pipeS1ytoS4Fifo);
-            }
+        // A failing stage keeps its exception here and aborts the others, main rethrows
+        // the first one after joining them so the handler at its end reports it
+        std::mutex stageErrorLock;
+        std::exception_ptr stageError;
+        auto startStage = [&](std::function<void()> body) {
+            stages.emplace_back([&, body]() {
+                try {
+                    body();
+                }
+                catch (...) {
+                    {
+                        std::lock_guard<std::mutex> guard(stageErrorLock);
+                        if (!stageError) {
+                            stageError = std::current_exception();
+                        }
+                    }
+                    abortPipeline();
+                }
+            });
+        };
 
-            /* *** Pipeline Stage 4: Render Results *** */
-            if (((!pipeS3toS4Fifo.empty() && !pipeS1toS4Fifo.empty()) &&  vp_enabled) 
-                    ||  (!pipeS1ytoS4Fifo.empty() && yolo_enabled) 
-                    || (!pipeS1ytoS4Fifo.empty() && vp2_enabled)) {
+        //------------------------------------------------------------------------------------
+        //------------------- Frame Read Stage -----------------------------------------------
+        //------------------------------------------------------------------------------------
+        auto decodeStage = [&]() {
+            // Frames are batched as they are decoded, a batch leaves full or after -batch_wait ms
+            StreamBatcher batcher(laneBatch, std::chrono::milliseconds(FLAGS_batch_wait), laneInputs);
+            streams.decode(batcher, stopRequested, totalFrames);
+        };
 
+        //------------------------------------------------------------------------------------
+        //------------------- Tracking Stage -------------------------------------------------
+        //------------------------------------------------------------------------------------
+        auto trackStage = [&]() {
+            std::vector<std::pair<cv::Rect, int>> firstResults;
+            const int stats_period = 5;  // frames between two prints of the counts of a stream, at least
+            for (size_t si = 0; si < streams.size(); si++) {
+                streams[si].frames_since_stats = stats_period;
+            }
+            bool ok = true;
+
+            while (ok) {
+                // Every lane yields the same frames in the same order, so one item from
+                // each of them belongs to the same frame
                 FramePipelineFifoItem ps3s4i;
                 FramePipelineFifoItem ps1s4i;
                 FramePipelineFifoItem ps1ys4i;
 
                 cv::Mat outputFrame;
-                cv::Mat* outputFrame2;
+                cv::Mat* outputFrame2 = nullptr;
+                // the detectors ran on this frame, its detections go to the tracking system
+                bool keyFrame = false;
+                int streamId = 0;
 
                 if(vp_enabled){
-                    ps3s4i = pipeS3toS4Fifo.front();
-                    pipeS3toS4Fifo.pop();
-                    ps1s4i = pipeS1toS4Fifo.front();
-                    pipeS1toS4Fifo.pop();
+                    if (!pedestriansResults.dequeue(ps3s4i) || !vehicleResults.dequeue(ps1s4i)) {
+                        break;
+                    }
 
                     outputFrame = *(ps3s4i.outputFrame);
                     outputFrame2 = ps3s4i.outputFrame;
+                    keyFrame = ps3s4i.keyFrame;
+                    streamId = ps3s4i.streamId;
                     
                     // draw box around vehicles
                     for (auto && loc : ps1s4i.resultsLocations) {
 			if(!FLAGS_tracking) {
 			    cv::rectangle(outputFrame, loc.first, COLOR_CAR, 1);
 			}
-                        if (firstFrameWithDetections || update_counter == update_frame){
+                        if (keyFrame){
                             firstResults.push_back(std::make_pair(loc.first, LABEL_CAR));
                         }
                     }
@@ -321,18 +450,21 @@ int main(int argc, char *argv[]) {
                         if(!FLAGS_tracking) {
 			    cv::rectangle(outputFrame, loc.first, COLOR_PERSON, 1);
 			}
-                        if (firstFrameWithDetections || update_counter == update_frame){
+                        if (keyFrame){
                             firstResults.push_back(std::make_pair(loc.first, LABEL_PERSON));
                         }
                     }
                 }
 
                 if(yolo_enabled){
-                    ps1ys4i = pipeS1ytoS4Fifo.front();
-                    pipeS1ytoS4Fifo.pop();
+                    if (!yoloResults.dequeue(ps1ys4i)) {
+                        break;
+                    }
 
                     outputFrame = *(ps1ys4i.outputFrame);
                     outputFrame2 = ps1ys4i.outputFrame;
+                    keyFrame = ps1ys4i.keyFrame;
+                    streamId = ps1ys4i.streamId;
 
                     for (auto && loc : ps1ys4i.resultsLocations) {
                         if(!FLAGS_tracking) {
@@ -350,18 +482,21 @@ int main(int argc, char *argv[]) {
 				}
 				cv::rectangle(outputFrame, loc.first, color_obj, 1);
 			}
-                        if (firstFrameWithDetections || update_counter == update_frame){
+                        if (keyFrame){
                             firstResults.push_back(loc);
                         }
                     }
                 }
 
                 if(vp2_enabled){
-                    ps1ys4i = pipeS1ytoS4Fifo.front();
-                    pipeS1ytoS4Fifo.pop();
+                    if (!vpResults.dequeue(ps1ys4i)) {
+                        break;
+                    }
 
                     outputFrame = *(ps1ys4i.outputFrame);
                     outputFrame2 = ps1ys4i.outputFrame;
+                    keyFrame = ps1ys4i.keyFrame;
+                    streamId = ps1ys4i.streamId;
 
                     for (auto && loc : ps1ys4i.resultsLocations) {
 
@@ -388,32 +523,57 @@ int main(int argc, char *argv[]) {
                                 }
 				cv::rectangle(outputFrame, loc.first, color_obj, 1);
 			}
-                        if (firstFrameWithDetections || update_counter == update_frame ){
+                        if (keyFrame){
                             firstResults.push_back(loc);
                         }
                     }
                 }
 
+                // every stream has its own targets
+                VideoStream &stream = streams[streamId];
+                TrackingSystem &tracking_system = stream.tracking_system;
+
                 if(FLAGS_tracking) {
-                    if(firstFrameWithDetections){
+                    if(stream.first_frame_with_detections){
                     tracking_system.setFrameWidth(outputFrame.cols);
                     tracking_system.setFrameHeight(outputFrame.rows);
                     tracking_system.setInitTarget(firstResults);
                     tracking_system.initTrackingSystem();
                     }
-                    if( update_counter == update_frame ){
+                    else if (keyFrame) {
+                        const int firstNewID = tracking_system.getTrackerManager().getNextID();
                         tracking_system.updateTrackingSystem(firstResults);
+                        stream.scheduler.keyFrameDone(tracking_system.getTrackerManager().getNextID() - firstNewID);
                     }
                     int tracking_success = tracking_system.startTracking(outputFrame);
                     if (tracking_success == FAIL){
+                        abortPipeline();
                         break;
                     }
+                    // how well the trackers hold on decides when the detectors run next
+                    double minPsr = std::numeric_limits<double>::max();
+                    double activity = 0;
+                    int n_tracked = 0;
+                    for (auto && tracker : tracking_system.getTrackerManager().getTrackerVec()) {
+                        if (!tracker->getIsTrackingStarted() || !tracker->isActive() || tracker->getConfidence() <= 0) {
+                            continue;
+                        }
+                        const cv::Rect rect = tracker->getRect();
+                        minPsr = std::min(minPsr, tracker->getConfidence());
+                        // per frame displacement, getModVel() spans vel_frames frames
+                        const cv::Point2d vel = tracker->getMotionVel();
+                        activity += std::sqrt(vel.x * vel.x + vel.y * vel.y) / std::max(1, std::max(rect.width, rect.height));
+                        n_tracked++;
+                    }
+                    // every frame reports, the scheduler counts them to match them with the decoded ones
+                    stream.scheduler.frameTracked(minPsr, n_tracked > 0 ? activity / n_tracked : 0);
                     if (tracking_system.getTrackerManager().getTrackerVec().size() != 0){
                         tracking_system.drawTrackingResult(outputFrame);
                         tracking_system.detectCollisions(outputFrame);
                     }
                 }
- if(update_counter == update_frame){
+                if (keyFrame && stream.frames_since_stats >= stats_period) {
+                    stream.frames_since_stats = 0;
                     int n_person = 0;
                     int n_car = 0;
                     int n_bus = 0;
@@ -448,7 +608,10 @@ int main(int argc, char *argv[]) {
                         }
                     }
                     int clear = std::system("clear");
-                    std::cout << "Frame n°:[" << totalFrames << "]" << std::endl;
+                    if (streams.size() > 1) {
+                        std::cout << "Stream:       " << stream.source << std::endl;
+                    }
+                    std::cout << "Frame n°:[" << totalFrames.load() << "]" << std::endl;
                     std::cout << "Amount of infered objects: " << firstResults.size() << std::endl; 
                     std::cout << "Person:       " << n_person << std::endl; 
                     std::cout << "Cars:         " << n_car << std::endl; 
@@ -457,104 +620,126 @@ int main(int argc, char *argv[]) {
                     std::cout << "Bicycle:      " << n_bike << std::endl; 
                     std::cout << "Motorbike:    " << n_motorbike << std::endl; 
                     std::cout << "Unknown:      " << n_ukn << std::endl; 
-                    std::cout << last_event << std::endl;
+                    std::cout << stream.last_event << std::endl;
                 }
 
-                firstFrameWithDetections = false;
-                firstResults.clear();
-                update_counter++;
-                if (update_counter > update_frame) {
-                    update_counter = 0;
-		}
-		        // ----------------------------Execution statistics -----------------------------------------------------
-                std::ostringstream out;
-				std::ostringstream out1;
-				std::ostringstream out2;
-
-				/*if (VehicleDetection.maxBatch > 1) {
-                    out1 << "OpenCV cap/render (avg) Vehicles time: " << std::fixed << std::setprecision(2)
-                        << (ocv_decode_time_vehicle / numSyncFrames + ocv_render_time / totalFrames) << " ms";
-                } else {
-                    out1 << "OpenCV cap/render Vehicles time: " << std::fixed << std::setprecision(2)
-                        << (ocv_decode_time_vehicle + ocv_render_time) << " ms";
-                    ocv_render_time = 0;
+                if (keyFrame) {
+                    stream.first_frame_with_detections = false;
                 }
-                if (PedestriansDetection.maxBatch > 1) {
-                    out2 << "OpenCV cap/render (avg) pedestrians time: " << std::fixed << std::setprecision(2)
-                        << (ocv_decode_time_pedestrians / numSyncFrames + ocv_render_time / totalFrames) << " ms";
-                } else {
-                    out2 << "OpenCV cap/render pedestrians time: " << std::fixed << std::setprecision(2)
-                        << (ocv_decode_time_pedestrians + ocv_render_time) << " ms";
-                    ocv_render_time = 0;
-                }*/
-                ocv_decode_time_pedestrians = 0;
-                ocv_decode_time_vehicle = 0;
-
-                cv::putText(outputFrame, out1.str(), cv::Point2f(0, 25), cv::FONT_HERSHEY_TRIPLEX, 0.5, cv::Scalar(255, 0, 0));
-                cv::putText(outputFrame, out2.str(), cv::Point2f(0, 50), cv::FONT_HERSHEY_TRIPLEX, 0.5, cv::Scalar(0, 255, 0));
-
-                // When running asynchronously, timing metrics are not accurate so do not display them
-                if (!runningAsync) {
-                    out.str("");
-                    out << "Vehicle detection time ";
-                    if (VehicleDetection.maxBatch > 1) {
-                        out << "(batch size = " << VehicleDetection.maxBatch << ") ";
-                    }
-                    out << ": " << std::fixed << std::setprecision(2) << detection_time.count()
-                        << " ms ("
-                        << 1000.F * numSyncFrames / detection_time.count() << " fps)";
-                    cv::putText(outputFrame, out.str(), cv::Point2f(0, 75), cv::FONT_HERSHEY_TRIPLEX, 0.5,
-                                cv::Scalar(255, 0, 0));
+                firstResults.clear();
+                stream.frames_since_stats++;
 
-                }
+                // hand the drawn frame over to the render stage
+                FramePipelineFifoItem ps4i;
+                ps4i.outputFrame = outputFrame2;
+                ps4i.streamId = streamId;
+                ok = renderQueue.enqueue(ps4i);
+            }
+            closeWhenDrained(renderQueue);
+        };
 
-                // -----------------------Display Results ---------------------------------------------
-                t0 = std::chrono::high_resolution_clock::now();
-                if (!FLAGS_no_show) {
-                    cv::imshow("Detection results", outputFrame);
-                    lastOutputFrame = &outputFrame;
-                }
-                t1 = std::chrono::high_resolution_clock::now();
-                ocv_render_time += std::chrono::duration_cast<ms>(t1 - t0).count();
-
-                // watch for keypress to stop or snapshot
-                int keyPressed;
-                if (-1 != (keyPressed = cv::waitKey(1)))
-                {
-                    if ('s' == keyPressed) {
-                        // save screen to output file
-                        slog::info << "Saving snapshot of image" << slog::endl;
-                        cv::imwrite("snapshot.bmp", outputFrame);
-                    } else {
-                        haveMoreFrames = false;
+        if (vp_enabled) {
+            addDetector(VehicleDetection, &vehicleInput, &vehicleResults);
+            addDetector(PedestriansDetection, &pedestriansInput, &pedestriansResults);
+        }
+        if (vp2_enabled) {
+            addDetector(VPDetection, &vpInput, &vpResults);
+        }
+        if (yolo_enabled) {
+            addDetector(GeneralDetection, &yoloInput, &yoloResults);
+        }
+        if (laneInputs.empty()) {
+            throw std::invalid_argument("No detection model was given, check the -m* parameters");
+        }
+
+        if (!FLAGS_no_show) {
+            slog::info << "Press 's' key to save a snapshot, press any other key to stop" << slog::endl;
+        }
+
+        // Joins the stages however this scope is left, if the render loop throws they are aborted first
+        struct StageJoiner {
+            std::vector<std::thread> &stages;
+            std::function<void()> abort;
+            void join() {
+                for (auto && stage : stages) {
+                    if (stage.joinable()) {
+                        stage.join();
                     }
                 }
-
-                // done with frame buffer, return to queue
-                inputFramePtrs.push(outputFrame2);
             }
+            ~StageJoiner() {
+                if (std::any_of(stages.begin(), stages.end(), [](const std::thread &stage) { return stage.joinable(); })) {
+                    abort();
+                    join();
+                }
+            }
+        } stageJoiner{stages, abortPipeline};
 
-            // wait until break from key press after all pipeline stages have completed
-            done = !haveMoreFrames && pipeS0toS1Fifo.empty() && pipeS1toS2Fifo.empty() && pipeS2toS3Fifo.empty()
-                        && pipeS3toS4Fifo.empty() && pipeS0toS2Fifo.empty() && pipeS1toS4Fifo.empty() 
-                        && pipeS0ytoS1yFifo.empty() && pipeS1ytoS4Fifo.empty();
-            // end of file we just keep last image/frame displayed to let user check what was shown
-            if (done) {
-                // done processing, save time
-                wallclockEnd = std::chrono::high_resolution_clock::now();
-
-                if (!FLAGS_no_wait && !FLAGS_no_show) {
-                    slog::info << "Press 's' key to save a snapshot, press any other key to exit" << slog::endl;
-                    while (cv::waitKey(0) == 's') {
-                        // save screen to output file
-                        slog::info << "Saving snapshot of image" << slog::endl;
-                        cv::imwrite("snapshot.bmp", *lastOutputFrame);
-                    }
-                    haveMoreFrames = false;
-                    break;
+        wallclockStart = std::chrono::high_resolution_clock::now();
+        /** Start inference & calc performance **/
+        for (size_t lane = 0; lane < runningDetectors.size(); lane++) {
+            BaseDetection *detector = runningDetectors[lane];
+            FramePipelineQueue *in = laneInputs[lane];
+            FramePipelineQueue *out = laneOutputs[lane];
+            startStage([detector, in]() { detector->preprocess_stage(in); });
+            startStage([detector]() { detector->submit_stage(); });
+            startStage([detector, out]() { detector->collect_stage(out); });
+        }
+        startStage(decodeStage);
+        startStage(trackStage);
+
+        //------------------------------------------------------------------------------------
+        //------------------- Render Stage ---------------------------------------------------
+        //------------------------------------------------------------------------------------
+        FramePipelineFifoItem ps5i;
+        while (renderQueue.dequeue(ps5i)) {
+            std::chrono::high_resolution_clock::time_point t0;
+            std::chrono::high_resolution_clock::time_point t1;
+            cv::Mat outputFrame = *(ps5i.outputFrame);
+
+            // -----------------------Display Results ---------------------------------------------
+            t0 = std::chrono::high_resolution_clock::now();
+            if (!FLAGS_no_show) {
+                cv::imshow(windowName(ps5i.streamId), outputFrame);
+                lastOutputFrame = outputFrame;
+            }
+            t1 = std::chrono::high_resolution_clock::now();
+            ocv_render_time += std::chrono::duration_cast<ms>(t1 - t0).count();
+
+            // watch for keypress to stop or snapshot
+            int keyPressed;
+            if (-1 != (keyPressed = cv::waitKey(1)))
+            {
+                if ('s' == keyPressed) {
+                    // save screen to output file
+                    slog::info << "Saving snapshot of image" << slog::endl;
+                    cv::imwrite("snapshot.bmp", outputFrame);
+                } else {
+                    // stop reading, frames already in the pipeline are still shown
+                    stopRequested = true;
                 }
             }
-        } while(!done);
+
+            // done with frame buffer, return it to its stream
+            streams.release(ps5i.streamId, ps5i.outputFrame);
+        }
+
+        // done processing, save time
+        wallclockEnd = std::chrono::high_resolution_clock::now();
+        stageJoiner.join();
+        if (stageError) {
+            std::rethrow_exception(stageError);
+        }
+
+        // end of file we just keep last image/frame displayed to let user check what was shown
+        if (!FLAGS_no_wait && !FLAGS_no_show && !lastOutputFrame.empty()) {
+            slog::info << "Press 's' key to save a snapshot, press any other key to exit" << slog::endl;
+            while (cv::waitKey(0) == 's') {
+                // save screen to output file
+                slog::info << "Saving snapshot of image" << slog::endl;
+                cv::imwrite("snapshot.bmp", lastOutputFrame);
+            }
+        }
 
         // calculate total run time
         ms total_wallclock_time = std::chrono::duration_cast<ms>(wallclockEnd - wallclockStart);
@@ -562,8 +747,8 @@ int main(int argc, char *argv[]) {
         // report loop time
         slog::info << "     Total main-loop time:" << std::fixed << std::setprecision(2)
                 << total_wallclock_time.count() << " ms " <<  slog::endl;
-        slog::info << "           Total # frames:" << totalFrames <<  slog::endl;
-        float avgTimePerFrameMs = total_wallclock_time.count() / (float)totalFrames;
+        slog::info << "           Total # frames:" << totalFrames.load() <<  slog::endl;
+        float avgTimePerFrameMs = total_wallclock_time.count() / (float)totalFrames.load();
         slog::info << "   Average time per frame:" << std::fixed << std::setprecision(2)
                     << avgTimePerFrameMs << " ms "
                     << "(" << 1000.0F / avgTimePerFrameMs << " fps)" << slog::endl;
@@ -573,7 +758,6 @@ int main(int argc, char *argv[]) {
             VehicleDetection.printPerformanceCounts();
         }
 
-        delete [] inputFrames;
     }
     catch (const std::exception& error) {
         slog::err << error.what() << slog::endl;
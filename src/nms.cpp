@@ -0,0 +1,153 @@
+#include "nms.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+	// Kept boxes of one bucket as structure of arrays, sorted by xmin
+	struct KeptBoxes
+	{
+		std::vector<float> xmin, ymin, xmax, ymax, area;
+		float maxWidth = 0;
+
+		void insert(const NmsBox& box)
+		{
+			const size_t at = std::upper_bound(this->xmin.begin(), this->xmin.end(), box.xmin) - this->xmin.begin();
+			this->xmin.insert(this->xmin.begin() + at, box.xmin);
+			this->ymin.insert(this->ymin.begin() + at, box.ymin);
+			this->xmax.insert(this->xmax.begin() + at, box.xmax);
+			this->ymax.insert(this->ymax.begin() + at, box.ymax);
+			this->area.insert(this->area.begin() + at, (box.xmax - box.xmin) * (box.ymax - box.ymin));
+			this->maxWidth = std::max(this->maxWidth, box.xmax - box.xmin);
+		}
+
+		// Whether a kept box overlaps box by more than threshold
+		bool suppresses(const NmsBox& box, float threshold) const
+		{
+			// Only the boxes starting in [box.xmin - maxWidth, box.xmax) can reach it
+			size_t i = std::lower_bound(this->xmin.begin(), this->xmin.end(), box.xmin - this->maxWidth) - this->xmin.begin();
+			const size_t end = std::lower_bound(this->xmin.begin() + i, this->xmin.end(), box.xmax) - this->xmin.begin();
+			const float boxArea = (box.xmax - box.xmin) * (box.ymax - box.ymin);
+#ifdef __SSE2__
+			const __m128 bx0 = _mm_set1_ps(box.xmin), by0 = _mm_set1_ps(box.ymin);
+			const __m128 bx1 = _mm_set1_ps(box.xmax), by1 = _mm_set1_ps(box.ymax);
+			const __m128 barea = _mm_set1_ps(boxArea), thr = _mm_set1_ps(threshold);
+			const __m128 zero = _mm_setzero_ps();
+			for (; i + 4 <= end; i += 4)
+			{
+				const __m128 w = _mm_max_ps(zero, _mm_sub_ps(_mm_min_ps(bx1, _mm_loadu_ps(&this->xmax[i])), _mm_max_ps(bx0, _mm_loadu_ps(&this->xmin[i]))));
+				const __m128 h = _mm_max_ps(zero, _mm_sub_ps(_mm_min_ps(by1, _mm_loadu_ps(&this->ymax[i])), _mm_max_ps(by0, _mm_loadu_ps(&this->ymin[i]))));
+				const __m128 inter = _mm_mul_ps(w, h);
+				const __m128 uni = _mm_sub_ps(_mm_add_ps(barea, _mm_loadu_ps(&this->area[i])), inter);
+				// inter / union > thr, without the division
+				if (_mm_movemask_ps(_mm_cmpgt_ps(inter, _mm_mul_ps(thr, uni))))
+					return true;
+			}
+#endif
+			for (; i < end; i++)
+			{
+				const float w = std::max(0.0f, std::min(box.xmax, this->xmax[i]) - std::max(box.xmin, this->xmin[i]));
+				const float h = std::max(0.0f, std::min(box.ymax, this->ymax[i]) - std::max(box.ymin, this->ymin[i]));
+				const float inter = w * h;
+				if (inter > threshold * (boxArea + this->area[i] - inter))
+					return true;
+			}
+			return false;
+		}
+	};
+
+	void hardNms(const std::vector<NmsBox>& boxes, const std::vector<int>& bucket, const NmsParams& params, std::vector<int>& kept)
+	{
+		KeptBoxes keptBoxes;
+		for (auto && idx : bucket)
+		{
+			// The bucket is sorted, nothing after this one passes either
+			if (boxes[idx].score < params.scoreThreshold)
+				break;
+			if (keptBoxes.suppresses(boxes[idx], params.iouThreshold))
+				continue;
+			keptBoxes.insert(boxes[idx]);
+			kept.push_back(idx);
+		}
+	}
+
+	void softNms(std::vector<NmsBox>& boxes, std::vector<int> bucket, const NmsParams& params, std::vector<int>& kept)
+	{
+		// Scores change as boxes are kept, so the best one is searched again every time
+		while (!bucket.empty())
+		{
+			auto best = std::max_element(bucket.begin(), bucket.end(), [&boxes](int a, int b) {
+				return boxes[a].score < boxes[b].score;
+			});
+			const int idx = *best;
+			if (boxes[idx].score < params.scoreThreshold)
+				break;
+			kept.push_back(idx);
+			*best = bucket.back();
+			bucket.pop_back();
+
+			for (size_t k = 0; k < bucket.size(); )
+			{
+				NmsBox& other = boxes[bucket[k]];
+				const float iou = intersectionOverUnion(boxes[idx], other);
+				if (params.method == NmsParams::LINEAR)
+				{
+					if (iou > params.iouThreshold)
+						other.score *= 1 - iou;
+				}
+				else
+				{
+					other.score *= std::exp(-iou * iou / params.sigma);
+				}
+				if (other.score < params.scoreThreshold)
+				{
+					bucket[k] = bucket.back();
+					bucket.pop_back();
+				}
+				else
+				{
+					k++;
+				}
+			}
+		}
+	}
+
+}
+
+float intersectionOverUnion(const NmsBox& a, const NmsBox& b)
+{
+	const float w = std::min(a.xmax, b.xmax) - std::max(a.xmin, b.xmin);
+	const float h = std::min(a.ymax, b.ymax) - std::max(a.ymin, b.ymin);
+	if (w <= 0 || h <= 0)
+		return 0;
+	const float inter = w * h;
+	const float uni = (a.xmax - a.xmin) * (a.ymax - a.ymin) + (b.xmax - b.xmin) * (b.ymax - b.ymin) - inter;
+	return uni > 0 ? inter / uni : 0;
+}
+
+std::vector<int> nonMaximumSuppression(std::vector<NmsBox>& boxes, const NmsParams& params)
+{
+	std::map<int, std::vector<int>> buckets;
+	for (size_t i = 0; i < boxes.size(); i++)
+		buckets[params.classAware ? boxes[i].label : 0].push_back(static_cast<int>(i));
+
+	std::vector<int> kept;
+	for (auto && bucket : buckets)
+	{
+		std::vector<int>& idx = bucket.second;
+		std::stable_sort(idx.begin(), idx.end(), [&boxes](int a, int b) { return boxes[a].score > boxes[b].score; });
+		if (params.method == NmsParams::HARD)
+			hardNms(boxes, idx, params, kept);
+		else
+			softNms(boxes, idx, params, kept);
+	}
+
+	std::stable_sort(kept.begin(), kept.end(), [&boxes](int a, int b) { return boxes[a].score > boxes[b].score; });
+	return kept;
+}
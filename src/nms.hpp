@@ -0,0 +1,45 @@
+#pragma once
+
+#include <vector>
+
+/* ==========================================================================
+
+Non maximum suppression
+
+Boxes are bucketed by label (unless classAware is false) and each bucket is
+visited from the highest score down. A box is kept unless a kept box of the
+same bucket overlaps it by more than iouThreshold. The kept boxes are held
+sorted by xmin, so a candidate is only compared to the ones whose x range
+can reach it, four at a time with SSE, and the search stops at the first
+overlap. The cost is O(n log n) for scenes where boxes do not all pile up
+on each other, instead of the O(n^2) of the all-pairs sweep.
+
+Soft NMS decays the score of the overlapping boxes instead of dropping
+them (linearly by 1 - IoU, or by exp(-IoU^2 / sigma)), and drops a box once
+its score falls under scoreThreshold.
+
+========================================================================== */
+struct NmsBox
+{
+	float xmin, ymin, xmax, ymax;
+	float score;
+	int label;
+};
+
+struct NmsParams
+{
+	enum Method { HARD, LINEAR, GAUSSIAN };
+
+	float iouThreshold = 0.4f;
+	float scoreThreshold = 0.0f;	// Boxes under it are dropped
+	bool classAware = true;			// Only boxes of the same label suppress each other
+	Method method = HARD;
+	float sigma = 0.5f;				// Of the GAUSSIAN decay
+};
+
+// Returns the indexes of the kept boxes, by decreasing score. Soft NMS
+// writes the decayed scores back into boxes.
+std::vector<int> nonMaximumSuppression(std::vector<NmsBox>& boxes, const NmsParams& params);
+
+// Intersection over union of two boxes, 0 when they do not overlap
+float intersectionOverUnion(const NmsBox& a, const NmsBox& b);
@@ -1,11 +1,5 @@
 #include "object_detection.hpp"
 
-void ObjectDetection::submitRequest(){
-    if (!this -> enquedFrames) return;
-    this -> enquedFrames = 0;
-    this -> BaseDetection::submitRequest();
-}
-
 void ObjectDetection::enqueue(const cv::Mat &frame) {
     if (!this -> enabled()) return;
     if (this -> enquedFrames >= this -> maxBatch) {
@@ -15,15 +9,13 @@ void ObjectDetection::enqueue(const cv::Mat &frame) {
     if (nullptr == this -> requests[this -> inputRequestIdx]) {
 	    this -> requests[this -> inputRequestIdx] = this -> net.CreateInferRequestPtr();
     }
-    this -> width = frame.cols;
-    this -> height = frame.rows;
 	InferenceEngine::Blob::Ptr inputBlob;
     if (this -> auto_resize) {
         inputBlob = wrapMat2Blob(frame);
         this -> requests[this -> inputRequestIdx]->SetBlob(this -> input, inputBlob);
     } else {
 		inputBlob = this -> requests[this -> inputRequestIdx]->GetBlob(this -> input);
-		matU8ToBlob<uint8_t >(frame, inputBlob, this -> enquedFrames);
+		this -> fillInputBlob(frame, inputBlob, this -> enquedFrames);
 	}
     this -> enquedFrames++;
 }
@@ -88,28 +80,30 @@ void ObjectDetection::fetchResults(int inputBatchSize) {
     if (nullptr == this -> outputRequest) {
         return;
     }
-    this -> results.clear();
     const float *detections = this -> outputRequest->GetBlob(this -> output)->buffer().as<float *>();
-    // pretty much regular SSD post-processing
-	for (int i = 0; i < this -> maxProposalCount; i++) {
-		int proposalOffset = i * this -> objectSize;
-		float image_id = detections[proposalOffset + 0];
-		Result r;
-		r.batchIndex = image_id;
-		r.label = static_cast<int>(detections[proposalOffset + 1]);
-		r.confidence = detections[proposalOffset + 2];
-		if (r.confidence <= this -> detection_threshold) {
-			continue;
-		}
-		r.location.x = detections[proposalOffset + 3] * this -> width;
-		r.location.y = detections[proposalOffset + 4] * this -> height;
-		r.location.width = detections[proposalOffset + 5] * this -> width - r.location.x;
-		r.location.height = detections[proposalOffset + 6] * this -> height - r.location.y;
-		if ((image_id < 0) || (image_id >= inputBatchSize)) {  // indicates end of detections
-			break;
-		}
-		this -> results.push_back(r);
-	}
+    const float *end = detections + this -> maxProposalCount * this -> objectSize;
+    // pretty much regular SSD post-processing, the rows end with an image_id of -1
+    for (const float *row = detections; row != end; row += this -> objectSize) {
+        const int image_id = static_cast<int>(row[0]);
+        if ((image_id < 0) || (image_id >= inputBatchSize)) {  // indicates end of detections
+            break;
+        }
+        const int label = static_cast<int>(row[1]);
+        if (row[2] <= this -> thresholdOf(label)) {
+            continue;
+        }
+        // the batch may mix streams, scale to the frame the box belongs to
+        const cv::Size& frameSize = this -> outputFrameSizes[image_id];
+        Result r;
+        r.batchIndex = image_id;
+        r.label = label;
+        r.confidence = row[2];
+        r.location.x = row[3] * frameSize.width;
+        r.location.y = row[4] * frameSize.height;
+        r.location.width = row[5] * frameSize.width - r.location.x;
+        r.location.height = row[6] * frameSize.height - r.location.y;
+        this -> results[image_id].push_back(r);
+    }
 	// done with request
 	this -> outputRequest = nullptr;
 }
\ No newline at end of file
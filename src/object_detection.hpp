@@ -6,13 +6,11 @@ class ObjectDetection : public BaseDetection{
     std::string output;
     int maxProposalCount = 0;
     int objectSize = 0;
-    int enquedFrames = 0;
-    float width = 0;
-    float height = 0;
+    // Confidence threshold of each label, labels past the end or
+    // set to a negative value use detection_threshold
+    std::vector<float> labelThresholds;
     using BaseDetection::operator=;
 
-    void submitRequest() override;
-
     void enqueue(const cv::Mat &frame) override;
 
 
@@ -24,4 +22,9 @@ class ObjectDetection : public BaseDetection{
     InferenceEngine::CNNNetwork read() override;
 
     void fetchResults(int inputBatchSize) override;
+
+    float thresholdOf(int label) const {
+        return (label >= 0 && label < static_cast<int>(this -> labelThresholds.size()) && this -> labelThresholds[label] >= 0)
+                ? this -> labelThresholds[label] : this -> detection_threshold;
+    }
 };
\ No newline at end of file
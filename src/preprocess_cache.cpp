@@ -0,0 +1,64 @@
+#include "preprocess_cache.hpp"
+
+#include <cstring>
+
+#include "base_detection.hpp"
+
+PreprocessCache::PreprocessCache(int numConsumers)
+	: numConsumers(numConsumers)
+{
+}
+
+void PreprocessCache::fill(const cv::Mat* frame, InferenceEngine::Blob::Ptr& blob, int batchIndex)
+{
+	const InferenceEngine::TensorDesc& desc = blob->getTensorDesc();
+	const InferenceEngine::SizeVector& dims = desc.getDims();
+	if (!canWritePlanarU8(desc, *frame))
+	{
+		frameToPlanarBlob(*frame, blob, batchIndex);
+		return;
+	}
+
+	Format format;
+	format.height = static_cast<int>(dims[2]);
+	format.width = static_cast<int>(dims[3]);
+	format.layout = desc.getLayout();
+	format.precision = desc.getPrecision().name();
+
+	std::shared_ptr<Conversion> conversion;
+	{
+		std::lock_guard<std::mutex> guard(this->lock);
+		auto inserted = this->frames.insert(std::make_pair(frame, FrameEntry()));
+		if (inserted.second)
+			inserted.first->second.pending = this->numConsumers;
+		std::shared_ptr<Conversion>& slot = inserted.first->second.conversions[format];
+		if (!slot)
+			slot = std::make_shared<Conversion>();
+		conversion = slot;
+	}
+
+	// The other consumers of this format wait here until the first one is done
+	std::lock_guard<std::mutex> guard(conversion->lock);
+	if (!conversion->done)
+	{
+		conversion->planar.create(3 * format.height, format.width, CV_8UC1);
+		resizeToPlanar(*frame, format.width, format.height, conversion->planar.data);
+		conversion->done = true;
+	}
+	const size_t imageSize = conversion->planar.total();
+	std::memcpy(blob->buffer().as<uint8_t*>() + batchIndex * imageSize, conversion->planar.data, imageSize);
+}
+
+void PreprocessCache::release(const cv::Mat* frame)
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+	auto entry = this->frames.find(frame);
+	if (entry == this->frames.end())
+	{
+		// First consumer to see the frame does not need any conversion
+		entry = this->frames.insert(std::make_pair(frame, FrameEntry())).first;
+		entry->second.pending = this->numConsumers;
+	}
+	if (--entry->second.pending == 0)
+		this->frames.erase(entry);
+}
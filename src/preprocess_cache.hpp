@@ -0,0 +1,71 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+
+#include <inference_engine.hpp>
+#include <opencv2/opencv.hpp>
+
+/* ==========================================================================
+
+Class : PreprocessCache
+
+Network inputs computed from the frames of the pipeline, shared by the
+detectors. When several detectors want the same frame at the same input
+format (size, layout, precision), the first one to ask converts it and the
+others copy the result into their own blob.
+
+Every detector lane sees every frame, so an entry is dropped once each of
+the numConsumers lanes has called release() on its frame, which they do
+when they are done preprocessing it. A frame buffer is only reused after
+it left the pipeline, so by then nothing refers to its entry anymore.
+
+========================================================================== */
+class PreprocessCache
+{
+public:
+	explicit PreprocessCache(int numConsumers);
+
+	// Fills image batchIndex of blob with frame, converting it only if no
+	// other consumer did it before. Formats other than 3-channel U8 NCHW
+	// are converted in place every time.
+	void fill(const cv::Mat* frame, InferenceEngine::Blob::Ptr& blob, int batchIndex);
+
+	// The calling consumer is done with frame
+	void release(const cv::Mat* frame);
+
+private:
+	struct Format
+	{
+		int width;
+		int height;
+		int layout;
+		std::string precision;
+
+		bool operator<(const Format& other) const
+		{
+			return std::tie(this->width, this->height, this->layout, this->precision)
+				< std::tie(other.width, other.height, other.layout, other.precision);
+		}
+	};
+
+	struct Conversion
+	{
+		std::mutex lock;		// Held by whoever computes the data
+		bool done = false;
+		cv::Mat planar;			// channels * height rows of width bytes
+	};
+
+	struct FrameEntry
+	{
+		int pending;			// Consumers that did not release the frame yet
+		std::map<Format, std::shared_ptr<Conversion>> conversions;
+	};
+
+	const int numConsumers;
+	std::mutex lock;
+	std::map<const cv::Mat*, FrameEntry> frames;
+};
@@ -0,0 +1,55 @@
+#include "spatial_grid.hpp"
+
+#include <algorithm>
+
+SpatialGrid::SpatialGrid(int _cell_size)
+	: cell_size(std::max(1, _cell_size))
+{
+}
+
+void SpatialGrid::reset(int _cell_size)
+{
+	this->cell_size = std::max(1, _cell_size);
+	this->cells.clear();
+}
+
+// Floor division, boxes may stick out of the frame on the top and left
+int SpatialGrid::cellOf(int _coord) const
+{
+	return _coord >= 0 ? _coord / this->cell_size : -((-_coord + this->cell_size - 1) / this->cell_size);
+}
+
+void SpatialGrid::insert(int _item, const cv::Rect& _rect)
+{
+	if (_rect.width <= 0 || _rect.height <= 0)
+		return;
+
+	const int x0 = this->cellOf(_rect.x), x1 = this->cellOf(_rect.x + _rect.width - 1);
+	const int y0 = this->cellOf(_rect.y), y1 = this->cellOf(_rect.y + _rect.height - 1);
+	for (int cy = y0; cy <= y1; cy++)
+		for (int cx = x0; cx <= x1; cx++)
+			this->cells[key(cx, cy)].push_back(_item);
+}
+
+void SpatialGrid::query(const cv::Rect& _rect, std::vector<int>& _items) const
+{
+	_items.clear();
+	if (_rect.width <= 0 || _rect.height <= 0)
+		return;
+
+	const int x0 = this->cellOf(_rect.x), x1 = this->cellOf(_rect.x + _rect.width - 1);
+	const int y0 = this->cellOf(_rect.y), y1 = this->cellOf(_rect.y + _rect.height - 1);
+	for (int cy = y0; cy <= y1; cy++)
+	{
+		for (int cx = x0; cx <= x1; cx++)
+		{
+			auto cell = this->cells.find(key(cx, cy));
+			if (cell != this->cells.end())
+				_items.insert(_items.end(), cell->second.begin(), cell->second.end());
+		}
+	}
+
+	// A box spanning several cells is found in each of them
+	std::sort(_items.begin(), _items.end());
+	_items.erase(std::unique(_items.begin(), _items.end()), _items.end());
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+/* ==========================================================================
+
+Class : SpatialGrid
+
+Uniform grid over the frame, used to find the boxes that may overlap a box
+without looking at all of them.
+Every item (an index chosen by the caller) is stored in each cell its box
+touches. A query returns the items sharing a cell with the query box, so
+the caller still has to check the actual overlap.
+
+The cell size should be close to the size of the boxes: much smaller and a
+box spans many cells, much larger and a cell holds many boxes.
+
+========================================================================== */
+class SpatialGrid
+{
+public:
+	explicit SpatialGrid(int _cell_size = 64);
+
+	// Remove every item and use _cell_size from now on
+	void reset(int _cell_size);
+	void clear() { this->cells.clear(); }
+
+	void insert(int _item, const cv::Rect& _rect);
+
+	// Items sharing a cell with _rect, each once and in increasing order
+	void query(const cv::Rect& _rect, std::vector<int>& _items) const;
+
+	int getCellSize() const { return this->cell_size; }
+
+private:
+	int		cell_size;
+	std::unordered_map<unsigned long long, std::vector<int>> cells;	// Cell key -> items, empty cells are not stored
+
+	int cellOf(int _coord) const;
+	// Cells are negative above and left of the frame, the key is built from their unsigned bits
+	static unsigned long long key(int _cx, int _cy) { return (static_cast<unsigned long long>(static_cast<unsigned>(_cx)) << 32) | static_cast<unsigned>(_cy); }
+};
@@ -0,0 +1,110 @@
+#include "stream_batcher.hpp"
+
+#include <algorithm>
+
+StreamBatcher::StreamBatcher(int maxBatch, std::chrono::milliseconds maxWait, const std::vector<FramePipelineQueue*>& outputs)
+	: maxBatch(std::max(1, maxBatch)), maxWait(maxWait), outputs(outputs), outputsOpen(true), closing(false)
+{
+	if (this->maxWait.count() > 0)
+		this->deadlineThread = std::thread(&StreamBatcher::deadlineLoop, this);
+}
+
+StreamBatcher::~StreamBatcher()
+{
+	{
+		std::lock_guard<std::mutex> guard(this->lock);
+		this->closing = true;
+	}
+	this->pendingChanged.notify_all();
+	if (this->deadlineThread.joinable())
+		this->deadlineThread.join();
+}
+
+bool StreamBatcher::submit(int streamId, cv::Mat* frame, bool keyFrame)
+{
+	std::unique_lock<std::mutex> guard(this->lock);
+	if (!this->outputsOpen)
+		return false;
+	if (!keyFrame)
+	{
+		// The detectors skip it, there is no batch to fill. Only the frames of
+		// a stream have to stay in order, so the pending batch leaves first if
+		// it holds a frame of this stream, and keeps filling otherwise.
+		const std::vector<int>& pendingStreams = this->pending.batchOfStreamIds;
+		if (std::find(pendingStreams.begin(), pendingStreams.end(), streamId) != pendingStreams.end()
+			&& !this->flush())
+			return false;
+		FramePipelineFifoItem skipped;
+		skipped.batchOfInputFrames.push_back(frame);
+		skipped.batchOfStreamIds.push_back(streamId);
+		skipped.keyFrame = false;
+		return this->write(skipped);
+	}
+	if (this->pending.batchOfInputFrames.empty())
+	{
+		this->deadline = clock::now() + this->maxWait;
+		this->pendingChanged.notify_all();
+	}
+	this->pending.batchOfInputFrames.push_back(frame);
+	this->pending.batchOfStreamIds.push_back(streamId);
+	if (this->pending.batchOfInputFrames.size() >= this->maxBatch)
+		return this->flush();
+	return true;
+}
+
+void StreamBatcher::close()
+{
+	{
+		std::lock_guard<std::mutex> guard(this->lock);
+		if (this->outputsOpen && !this->pending.batchOfInputFrames.empty())
+			this->flush();
+		this->closing = true;
+	}
+	this->pendingChanged.notify_all();
+	if (this->deadlineThread.joinable())
+		this->deadlineThread.join();
+	for (auto && output : this->outputs)
+		closeWhenDrained(*output);
+}
+
+// The lock stays held while the outputs are written, so batches leave in
+// the order they were formed and a full pipeline holds every stream back.
+bool StreamBatcher::flush()
+{
+	this->pending.keyFrame = true;
+	this->write(this->pending);
+	this->pending.batchOfInputFrames.clear();
+	this->pending.batchOfStreamIds.clear();
+	return this->outputsOpen;
+}
+
+bool StreamBatcher::write(const FramePipelineFifoItem& batch)
+{
+	for (auto && output : this->outputs)
+	{
+		if (!this->outputsOpen)
+			break;
+		FramePipelineFifoItem copy = batch;
+		if (!output->enqueue(copy))
+			this->outputsOpen = false;
+	}
+	return this->outputsOpen;
+}
+
+void StreamBatcher::deadlineLoop()
+{
+	std::unique_lock<std::mutex> guard(this->lock);
+	while (!this->closing)
+	{
+		if (this->pending.batchOfInputFrames.empty())
+		{
+			this->pendingChanged.wait(guard);
+		}
+		else if (this->pendingChanged.wait_until(guard, this->deadline) == std::cv_status::timeout
+			&& !this->pending.batchOfInputFrames.empty() && clock::now() >= this->deadline)
+		{
+			// Partial batch, the oldest frame has waited long enough
+			this->flush();
+		}
+	}
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "base_detection.hpp"
+
+/* ==========================================================================
+
+Class : StreamBatcher
+
+Builds the inference batches of the detectors from the frames of any number
+of streams. Every stream hands its frames over with submit(), in its own
+order, and the frames are packed into one batch as they come, whatever
+their stream. A batch leaves when it holds maxBatch frames, or when its
+oldest frame has waited maxWait, so a slow stream does not hold back the
+others and a lone stream does not wait for a full batch.
+
+Each batch is written to every output queue, one per detector lane, so all
+lanes see the same batches in the same order. batchOfStreamIds[k] is the
+stream of batchOfInputFrames[k], the detectors copy it into the streamId
+of the frame they emit for Result::batchIndex k.
+
+========================================================================== */
+class StreamBatcher
+{
+public:
+	// maxWait of zero only flushes full batches (and the last one on close())
+	StreamBatcher(int maxBatch, std::chrono::milliseconds maxWait, const std::vector<FramePipelineQueue*>& outputs);
+	~StreamBatcher();
+
+	StreamBatcher(const StreamBatcher&) = delete;
+	StreamBatcher& operator=(const StreamBatcher&) = delete;
+
+	// Thread safe. Blocks while the outputs are full, returns false once one
+	// of them has been closed. A frame that is not a key frame skips the
+	// detectors, it goes out alone, after the pending batch if that one holds
+	// a frame of the same stream and ahead of it otherwise.
+	bool submit(int streamId, cv::Mat* frame, bool keyFrame = true);
+
+	// Flushes the pending frames and closes the outputs once they are drained.
+	// No submit() may follow.
+	void close();
+
+private:
+	typedef std::chrono::steady_clock clock;
+
+	// Writes the pending batch to the outputs, lock must be held
+	bool flush();
+	// Writes batch to every output, lock must be held
+	bool write(const FramePipelineFifoItem& batch);
+	void deadlineLoop();
+
+	const size_t maxBatch;
+	const std::chrono::milliseconds maxWait;
+	std::vector<FramePipelineQueue*> outputs;
+
+	std::mutex lock;
+	std::condition_variable pendingChanged;
+	FramePipelineFifoItem pending;
+	clock::time_point deadline;	// When the pending batch leaves at the latest
+	bool outputsOpen;
+	bool closing;
+	std::thread deadlineThread;
+};
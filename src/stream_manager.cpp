@@ -0,0 +1,122 @@
+#include "stream_manager.hpp"
+
+#include <exception>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+VideoStream::VideoStream(int _id, const std::string& _source, int _num_frames, unsigned _detect_interval)
+	: id(_id), source(_source), frames(_num_frames), free_frames(_num_frames), tracking_system(&this->last_event),
+	scheduler(_detect_interval), first_frame_with_detections(true), frames_since_stats(0)
+{
+	for (auto && frame : this->frames)
+	{
+		cv::Mat* frame_ptr = &frame;
+		this->free_frames.enqueue(frame_ptr);
+	}
+}
+
+std::vector<std::string> StreamManager::parseSources(const std::string& list)
+{
+	std::vector<std::string> sources;
+	std::stringstream ss(list);
+	std::string item;
+	while (std::getline(ss, item, ','))
+	{
+		if (!item.empty())
+			sources.push_back(item);
+	}
+	return sources;
+}
+
+StreamManager::StreamManager(const std::vector<std::string>& sources, int frames_per_stream, unsigned detect_interval)
+{
+	for (auto && source : sources)
+	{
+		std::unique_ptr<VideoStream> stream(new VideoStream(static_cast<int>(this->streams.size()), source, frames_per_stream, detect_interval));
+		bool opened;
+		if (source == "cam")
+			opened = stream->cap.open(0);
+		else if (source.compare(0, 4, "cam:") == 0)
+			opened = stream->cap.open(std::stoi(source.substr(4)));
+		else
+			opened = stream->cap.open(source);
+		if (!opened || !stream->cap.read(stream->scene.orig))
+			throw std::invalid_argument("Cannot open input file or camera: " + source);
+		// Do deep copy to preserve original frame
+		stream->scene.out = stream->scene.orig.clone();
+		this->streams.push_back(std::move(stream));
+	}
+	if (this->streams.empty())
+		throw std::invalid_argument("Parameter -i does not name any input");
+}
+
+void StreamManager::decode(StreamBatcher& batcher, const std::atomic<bool>& stop, std::atomic<int>& total_frames)
+{
+	std::vector<std::thread> threads;
+	std::mutex error_lock;
+	std::exception_ptr error;
+	for (auto && stream : this->streams)
+	{
+		VideoStream* decoded = stream.get();
+		threads.emplace_back([&, decoded]() {
+			try
+			{
+				this->decodeStream(*decoded, batcher, stop, total_frames);
+			}
+			catch (...)
+			{
+				// Keep the first failure and stop the other streams, it is rethrown once they are joined
+				{
+					std::lock_guard<std::mutex> guard(error_lock);
+					if (!error)
+						error = std::current_exception();
+				}
+				this->abort();
+			}
+		});
+	}
+	for (auto && thread : threads)
+		thread.join();
+	batcher.close();
+	if (error)
+		std::rethrow_exception(error);
+}
+
+void StreamManager::decodeStream(VideoStream& stream, StreamBatcher& batcher, const std::atomic<bool>& stop, std::atomic<int>& total_frames)
+{
+	bool first_frame = true;
+	while (!stop)
+	{
+		// wait for a free frame buffer, render stage gives them back
+		cv::Mat* frame;
+		if (!stream.free_frames.dequeue(frame))
+			break;
+		if (first_frame)
+		{
+			// the first frame was already read when the stream was opened
+			stream.scene.orig.copyTo(*frame);
+			first_frame = false;
+		}
+		else if (!stream.cap.read(*frame))
+		{
+			stream.free_frames.enqueue(frame);
+			break;
+		}
+		total_frames++;
+		if (!batcher.submit(stream.id, frame, stream.scheduler.nextIsKeyFrame()))
+			break;
+	}
+}
+
+void StreamManager::release(int _id, cv::Mat* _frame)
+{
+	this->streams[_id]->free_frames.enqueue(_frame);
+}
+
+void StreamManager::abort()
+{
+	for (auto && stream : this->streams)
+		stream->free_frames.disable();
+}
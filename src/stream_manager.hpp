@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <dlib/pipe.h>
+#include <opencv2/opencv.hpp>
+
+#include "Tracker.h"
+#include "detection_scheduler.hpp"
+#include "drawer.hpp"
+#include "stream_batcher.hpp"
+
+/* ==========================================================================
+
+Struct : VideoStream
+
+One input of the process (camera, video file or V4L device) with everything
+that belongs to it alone: its frame buffers, its tracking system and its
+detection schedule. The detectors are shared by all streams.
+
+========================================================================== */
+struct VideoStream
+{
+	VideoStream(int _id, const std::string& _source, int _num_frames, unsigned _detect_interval);
+
+	const int		id;
+	const std::string	source;
+	cv::VideoCapture	cap;
+	RegionsOfInterest	scene;			// scene.orig holds the first frame
+
+	std::vector<cv::Mat>	frames;			// Frame buffers of this stream
+	dlib::pipe<cv::Mat*>	free_frames;		// The ones not in the pipeline
+
+	std::string		last_event;
+	TrackingSystem		tracking_system;
+	DetectionScheduler	scheduler;
+
+	/* Tracking stage state */
+	bool			first_frame_with_detections;
+	int			frames_since_stats;
+};
+
+/* ==========================================================================
+
+Class : StreamManager
+
+Opens a list of sources and decodes each of them on its own thread into
+one StreamBatcher, so the frames of every stream share the detector
+batches.
+
+Every stream decodes into its own pool of frame buffers and only gets a
+buffer back once one of its own frames left the pipeline. A fast stream
+(a file read as fast as it decodes) can therefore not crowd out the
+others: each one has the same number of frames in flight at most.
+
+========================================================================== */
+class StreamManager
+{
+public:
+	// Splits a comma separated list of sources. "cam" and "cam:<n>" are
+	// local cameras, anything else is a file or device path for OpenCV.
+	static std::vector<std::string> parseSources(const std::string& list);
+
+	// Opens every source and reads its first frame into scene.orig,
+	// throws std::invalid_argument if one of them can not be read
+	StreamManager(const std::vector<std::string>& sources, int frames_per_stream, unsigned detect_interval);
+
+	size_t		size() const { return this->streams.size(); }
+	VideoStream&	operator[](size_t _id) { return *this->streams[_id]; }
+
+	// Decodes every stream into batcher until they all end or stop is set,
+	// then closes the batcher. Counts the decoded frames in total_frames.
+	// If a stream fails the others are stopped and its exception is rethrown.
+	void	decode(StreamBatcher& batcher, const std::atomic<bool>& stop, std::atomic<int>& total_frames);
+
+	// A frame of stream _id left the pipeline
+	void	release(int _id, cv::Mat* _frame);
+
+	// Unblocks the decode threads waiting for a frame buffer
+	void	abort();
+
+private:
+	void	decodeStream(VideoStream& stream, StreamBatcher& batcher, const std::atomic<bool>& stop, std::atomic<int>& total_frames);
+
+	std::vector<std::unique_ptr<VideoStream>> streams;
+};
@@ -0,0 +1,183 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <samples/slog.hpp>
+
+namespace {
+	unsigned shared_num_threads = 0;
+	std::vector<int> shared_cpus;
+}
+
+ThreadPool::ThreadPool(unsigned num_threads, const std::vector<int>& cpus)
+	: pending(0), next_worker(0), stopping(false)
+{
+	if (num_threads == 0)
+		num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+	for (unsigned i = 0; i < num_threads; i++)
+		this->workers.emplace_back(new Worker());
+
+	for (unsigned i = 0; i < num_threads; i++)
+	{
+		int cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
+		this->threads.emplace_back(&ThreadPool::workerLoop, this, i, cpu);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> guard(this->idle_lock);
+		this->stopping = true;
+	}
+	this->idle_cv.notify_all();
+	for (auto && thread : this->threads)
+		thread.join();
+}
+
+void ThreadPool::configureShared(unsigned num_threads, const std::vector<int>& cpus)
+{
+	shared_num_threads = num_threads;
+	shared_cpus = cpus;
+}
+
+ThreadPool& ThreadPool::shared()
+{
+	static ThreadPool pool(shared_num_threads, shared_cpus);
+	return pool;
+}
+
+void ThreadPool::push(Task task, size_t worker_idx)
+{
+	{
+		std::lock_guard<std::mutex> guard(this->workers[worker_idx]->lock);
+		this->workers[worker_idx]->tasks.push_back(std::move(task));
+	}
+	this->pending++;
+	// Take the idle lock so a worker checking for work cannot miss this wake up
+	{
+		std::lock_guard<std::mutex> guard(this->idle_lock);
+	}
+	this->idle_cv.notify_one();
+}
+
+bool ThreadPool::popLocal(size_t worker_idx, Task& task)
+{
+	Worker& worker = *this->workers[worker_idx];
+	std::lock_guard<std::mutex> guard(worker.lock);
+	if (worker.tasks.empty())
+		return false;
+	task = std::move(worker.tasks.back());
+	worker.tasks.pop_back();
+	return true;
+}
+
+bool ThreadPool::steal(size_t thief_idx, Task& task)
+{
+	const size_t n = this->workers.size();
+	for (size_t k = 1; k <= n; k++)
+	{
+		Worker& victim = *this->workers[(thief_idx + k) % n];
+		std::lock_guard<std::mutex> guard(victim.lock);
+		if (!victim.tasks.empty())
+		{
+			task = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+			return true;
+		}
+	}
+	return false;
+}
+
+bool ThreadPool::runOne(size_t worker_idx)
+{
+	Task task;
+	if (!this->popLocal(worker_idx, task) && !this->steal(worker_idx, task))
+		return false;
+	this->pending--;
+	task();
+	return true;
+}
+
+void ThreadPool::workerLoop(size_t worker_idx, int cpu)
+{
+#ifdef __linux__
+	if (cpu >= 0)
+	{
+		// main() checks -tracking_cpus against the affinity of the process, this
+		// only fails if that changed since
+		int error = EINVAL;
+		if (cpu < CPU_SETSIZE)
+		{
+			cpu_set_t cpu_set;
+			CPU_ZERO(&cpu_set);
+			CPU_SET(cpu, &cpu_set);
+			error = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+		}
+		if (error != 0)
+			slog::warn << "Tracking thread " << worker_idx << " could not be pinned to CPU " << cpu
+				<< " (" << std::strerror(error) << "), it runs unpinned" << slog::endl;
+	}
+#endif
+
+	while (true)
+	{
+		if (this->runOne(worker_idx))
+			continue;
+
+		std::unique_lock<std::mutex> guard(this->idle_lock);
+		this->idle_cv.wait(guard, [this] { return this->stopping || this->pending > 0; });
+		if (this->stopping && this->pending == 0)
+			return;
+	}
+}
+
+void ThreadPool::parallelFor(size_t begin, size_t end, size_t chunk_size, const std::function<void(size_t)>& fn)
+{
+	if (begin >= end)
+		return;
+
+	const size_t count = end - begin;
+	if (chunk_size == 0)
+		chunk_size = std::max<size_t>(1, count / (4 * (this->size() + 1)));
+
+	// Shared with the tasks, which may still be releasing it after the caller returned
+	struct Completion
+	{
+		std::atomic<size_t> remaining;
+		std::mutex lock;
+		std::condition_variable done;
+	};
+	std::shared_ptr<Completion> completion = std::make_shared<Completion>();
+	completion->remaining = (count + chunk_size - 1) / chunk_size;
+
+	for (size_t chunk_begin = begin; chunk_begin < end; chunk_begin += chunk_size)
+	{
+		const size_t chunk_end = std::min(end, chunk_begin + chunk_size);
+		this->push([completion, &fn, chunk_begin, chunk_end]() {
+			for (size_t i = chunk_begin; i < chunk_end; i++)
+				fn(i);
+			if (--completion->remaining == 0)
+			{
+				std::lock_guard<std::mutex> guard(completion->lock);
+				completion->done.notify_all();
+			}
+		}, this->next_worker++ % this->workers.size());
+	}
+
+	// Help with the queued work instead of sleeping
+	while (completion->remaining > 0)
+	{
+		if (this->runOne(this->next_worker % this->workers.size()))
+			continue;
+		std::unique_lock<std::mutex> guard(completion->lock);
+		completion->done.wait(guard, [&completion] { return completion->remaining == 0; });
+	}
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* ==========================================================================
+
+Class : ThreadPool
+
+Long-lived pool of worker threads with one task deque per worker.
+Workers take tasks from the back of their own deque and, once it is empty,
+steal from the front of the others, so uneven chunks (a few big targets
+among many small ones) still keep every core busy.
+The thread calling parallelFor() also runs tasks while it waits.
+
+One shared pool is meant to serve every camera in the process, see shared().
+Its threads can be limited and pinned to a set of CPUs so they do not fight
+with the threads of the inference plugin.
+
+========================================================================== */
+class ThreadPool
+{
+public:
+	// num_threads == 0 means one thread per hardware thread.
+	// If cpus is not empty, worker i is pinned to cpus[i % cpus.size()].
+	explicit ThreadPool(unsigned num_threads = 0, const std::vector<int>& cpus = std::vector<int>());
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// Process wide pool. configureShared() only has effect before the first call to shared().
+	static void configureShared(unsigned num_threads, const std::vector<int>& cpus);
+	static ThreadPool& shared();
+
+	unsigned size() const { return static_cast<unsigned>(this->workers.size()); }
+
+	// Calls fn(i) for every i in [begin, end) and returns once all calls are done.
+	// The range is cut into chunks of chunk_size indices (0 picks a size that gives
+	// every thread a few chunks to balance). fn must not throw.
+	void parallelFor(size_t begin, size_t end, size_t chunk_size, const std::function<void(size_t)>& fn);
+
+private:
+	typedef std::function<void()> Task;
+
+	struct Worker
+	{
+		std::mutex lock;
+		std::deque<Task> tasks;
+	};
+
+	void push(Task task, size_t worker_idx);
+	bool popLocal(size_t worker_idx, Task& task);
+	bool steal(size_t thief_idx, Task& task);
+	bool runOne(size_t worker_idx);
+	void workerLoop(size_t worker_idx, int cpu);
+
+	std::vector<std::unique_ptr<Worker>> workers;
+	std::vector<std::thread> threads;
+	std::atomic<size_t> pending;   // Tasks queued but not taken yet
+	std::atomic<size_t> next_worker;
+	std::mutex idle_lock;
+	std::condition_variable idle_cv;
+	bool stopping;
+};
@@ -1,5 +1,13 @@
 #include "yolo_detection.hpp"
 
+#include <exception>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "thread_pool.hpp"
+
 #define yolo_scale_13 13
 #define yolo_scale_26 26
 #define yolo_scale_52 52
@@ -11,53 +19,59 @@ void FrameToBlob(const cv::Mat &frame, InferenceEngine::InferRequest::Ptr &infer
     } else {
         /* Resize and copy data from the image to the input blob */
         InferenceEngine::Blob::Ptr frameBlob = inferRequest->GetBlob(inputName);
-        matU8ToBlob<uint8_t>(frame, frameBlob);
+        frameToPlanarBlob(frame, frameBlob);
     }
 }
 
-static int EntryIndex(int side, int lcoords, int lclasses, int location, int entry) {
-    int n = location / (side * side);
-    int loc = location % (side * side);
-    return n * side * side * (lcoords + lclasses + 1) + entry * side * side + loc;
+RegionYoloParams::RegionYoloParams(const InferenceEngine::CNNLayerPtr &layer) {
+    if (layer->type != "RegionYolo")
+        throw std::runtime_error("Invalid output type: " + layer->type + ". RegionYolo expected");
+    this->name = layer->name;
+    this->num = layer->GetParamAsInt("num");
+    try { this->num = layer->GetParamAsInts("mask").size(); } catch (...) {}
+    this->coords = layer->GetParamAsInt("coords");
+    this->classes = layer->GetParamAsInt("classes");
+    this->anchors = {10.0, 13.0, 16.0, 30.0, 33.0, 23.0, 30.0, 61.0, 62.0, 45.0, 59.0, 119.0, 116.0, 90.0,156.0, 198.0, 373.0, 326.0};
+    //this->anchors = {10.0, 14.0, 23.0, 27.0, 37.0, 58.0, 81.0, 82.0, 135.0, 169.0, 344.0, 319.0};
+    try { this->anchors = layer->GetParamAsFloats("anchors"); } catch (...) {}
 }
 
-double IntersectionOverUnion(const DetectionObject &box_1, const DetectionObject &box_2) {
-    double width_of_overlap_area = fmin(box_1.xmax, box_2.xmax) - fmax(box_1.xmin, box_2.xmin);
-    double height_of_overlap_area = fmin(box_1.ymax, box_2.ymax) - fmax(box_1.ymin, box_2.ymin);
-    double area_of_overlap;
-    if (width_of_overlap_area < 0 || height_of_overlap_area < 0)
-        area_of_overlap = 0;
-    else
-        area_of_overlap = width_of_overlap_area * height_of_overlap_area;
-    double box_1_area = (box_1.ymax - box_1.ymin)  * (box_1.xmax - box_1.xmin);
-    double box_2_area = (box_2.ymax - box_2.ymin)  * (box_2.xmax - box_2.xmin);
-    double area_of_union = box_1_area + box_2_area - area_of_overlap;
-    return area_of_overlap / area_of_union;
+// Appends to cells the indexes of the plane values >= threshold
+static void CellsAboveThreshold(const float *plane, int size, float threshold, std::vector<int> &cells) {
+    int i = 0;
+#ifdef __SSE2__
+    const __m128 thr = _mm_set1_ps(threshold);
+    for (; i + 4 <= size; i += 4) {
+        int mask = _mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(plane + i), thr));
+        // most cells hold no object, skip them four at a time
+        while (mask) {
+            const int k = __builtin_ctz(mask);
+            cells.push_back(i + k);
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for (; i < size; i++) {
+        if (plane[i] >= threshold)
+            cells.push_back(i);
+    }
 }
 
-void ParseYOLOV3Output(const InferenceEngine::CNNLayerPtr &layer, const InferenceEngine::Blob::Ptr &blob, const unsigned long resized_im_h,
+void ParseYOLOV3Output(const RegionYoloParams &params, const InferenceEngine::Blob::Ptr &blob, const int batchIndex, const unsigned long resized_im_h,
                        const unsigned long resized_im_w, const unsigned long original_im_h,
                        const unsigned long original_im_w,
                        const double threshold, std::vector<DetectionObject> &objects) {
     // --------------------------- Validating output parameters -------------------------------------
-    if (layer->type != "RegionYolo")
-        throw std::runtime_error("Invalid output type: " + layer->type + ". RegionYolo expected");
     const int out_blob_h = static_cast<int>(blob->getTensorDesc().getDims()[2]);
     const int out_blob_w = static_cast<int>(blob->getTensorDesc().getDims()[3]);
     if (out_blob_h != out_blob_w)
-        throw std::runtime_error("Invalid size of output " + layer->name +
+        throw std::runtime_error("Invalid size of output " + params.name +
         " It should be in NCHW layout and H should be equal to W. Current H = " + std::to_string(out_blob_h) +
         ", current W = " + std::to_string(out_blob_h));
-    // --------------------------- Extracting layer parameters -------------------------------------
-    auto num = layer->GetParamAsInt("num");
-    try { num = layer->GetParamAsInts("mask").size(); } catch (...) {}
-    auto coords = layer->GetParamAsInt("coords");
-    auto classes = layer->GetParamAsInt("classes");
-    std::vector<float> anchors = {10.0, 13.0, 16.0, 30.0, 33.0, 23.0, 30.0, 61.0, 62.0, 45.0, 59.0, 119.0, 116.0, 90.0,156.0, 198.0, 373.0, 326.0};
-    //std::vector<float> anchors = {10.0, 14.0, 23.0, 27.0, 37.0, 58.0, 81.0, 82.0, 135.0, 169.0, 344.0, 319.0};
-    //std::vector<float> anchors = {};
-    //anchors = layer->GetParamAsFloats("anchors");
-    try { anchors = layer->GetParamAsFloats("anchors"); } catch (...) {}
+    const int num = params.num;
+    const int coords = params.coords;
+    const int classes = params.classes;
+    const std::vector<float> &anchors = params.anchors;
     auto side = out_blob_h;
     int anchor_offset = 0;
     if (anchors.size() == 12){ //yolo_v3-tiny
@@ -86,45 +100,46 @@ void ParseYOLOV3Output(const InferenceEngine::CNNLayerPtr &layer, const Inferenc
                 throw std::runtime_error("Invalid output size");
         }
     }
-    
-    auto side_square = side * side;
-    const float *output_blob = blob->buffer().as<InferenceEngine::PrecisionTrait<InferenceEngine::Precision::FP32>::value_type *>();
+
+    const int side_square = side * side;
+    const InferenceEngine::SizeVector &blob_dims = blob->getTensorDesc().getDims();
+    const size_t image_size = blob_dims[1] * blob_dims[2] * blob_dims[3];
+    // the images of a batch follow each other in the NCHW blob
+    const float *output_blob = blob->buffer().as<InferenceEngine::PrecisionTrait<InferenceEngine::Precision::FP32>::value_type *>()
+                                + batchIndex * image_size;
+    const float h_scale = static_cast<float>(original_im_h) / static_cast<float>(resized_im_h);
+    const float w_scale = static_cast<float>(original_im_w) / static_cast<float>(resized_im_w);
+    const float thr = static_cast<float>(threshold);
     // --------------------------- Parsing YOLO Region output -------------------------------------
-    for (int i = 0; i < side_square; ++i) {
-        int row = i / side;
-        int col = i % side;
-        for (int n = 0; n < num; ++n) {
-            int obj_index = EntryIndex(side, coords, classes, n * side * side + i, coords);
-            int box_index = EntryIndex(side, coords, classes, n * side * side + i, 0);
-            float scale = output_blob[obj_index];
-            //std::cout << scale << std::endl;
-            if (scale < threshold){
-                continue;
-            }
-            double x = (col + output_blob[box_index + 0 * side_square]) / side * resized_im_w;
-            double y = (row + output_blob[box_index + 1 * side_square]) / side * resized_im_h;
-            double height = std::exp(output_blob[box_index + 3 * side_square]) * anchors[anchor_offset + 2 * n + 1];
-            double width = std::exp(output_blob[box_index + 2 * side_square]) * anchors[anchor_offset + 2 * n];
+    // Each anchor owns coords + 1 + classes consecutive planes of side x side values:
+    // the box, the objectness, then one probability plane per class
+    std::vector<int> cells;
+    for (int n = 0; n < num; ++n) {
+        const float *anchor_planes = output_blob + n * side_square * (coords + classes + 1);
+        const float *objectness = anchor_planes + coords * side_square;
+        // prob = objectness * class probability <= objectness, so only these cells can pass
+        cells.clear();
+        CellsAboveThreshold(objectness, side_square, thr, cells);
+        for (auto && i : cells) {
+            const int row = i / side;
+            const int col = i % side;
+            const float scale = objectness[i];
+            double x = (col + anchor_planes[i + 0 * side_square]) / side * resized_im_w;
+            double y = (row + anchor_planes[i + 1 * side_square]) / side * resized_im_h;
+            double height = std::exp(anchor_planes[i + 3 * side_square]) * anchors[anchor_offset + 2 * n + 1];
+            double width = std::exp(anchor_planes[i + 2 * side_square]) * anchors[anchor_offset + 2 * n];
+            const float *class_probs = objectness + side_square + i;
             for (int j = 0; j < classes; ++j) {
-                int class_index = EntryIndex(side, coords, classes, n * side_square + i, coords + 1 + j);
-                float prob = scale * output_blob[class_index];
-                if (prob < threshold)
+                float prob = scale * class_probs[j * side_square];
+                if (prob < thr)
                     continue;
-                DetectionObject obj(x, y, height, width, j, prob,
-                        static_cast<float>(original_im_h) / static_cast<float>(resized_im_h),
-                        static_cast<float>(original_im_w) / static_cast<float>(resized_im_w));
+                DetectionObject obj(x, y, height, width, j, prob, h_scale, w_scale);
                 objects.push_back(obj);
             }
         }
     }
 }
 
-void YoloDetection::submitRequest() {
-    if (! this -> enquedFrames) return;
-    this -> enquedFrames = 0;
-    this -> BaseDetection::submitRequest();
-}
-
 void YoloDetection::enqueue(const cv::Mat &frame) {
     if (!this -> enabled()) return;
     if (this -> enquedFrames >= this -> maxBatch) {
@@ -134,15 +149,13 @@ void YoloDetection::enqueue(const cv::Mat &frame) {
     if (nullptr == this -> requests[this -> inputRequestIdx]) {
         this -> requests[this -> inputRequestIdx] = this -> net.CreateInferRequestPtr();
     }
-    this -> width = frame.cols;
-    this -> height = frame.rows;
 	InferenceEngine::Blob::Ptr inputBlob;
     if (this -> auto_resize) {
         inputBlob = wrapMat2Blob(frame);
         this -> requests[this -> inputRequestIdx]->SetBlob(this -> input_name, inputBlob);
     } else {
 		inputBlob = this -> requests[this -> inputRequestIdx]->GetBlob(this -> input_name);
-		matU8ToBlob<uint8_t >(frame, inputBlob, this -> enquedFrames);
+		this -> fillInputBlob(frame, inputBlob, this -> enquedFrames);
     }
     this -> enquedFrames++;
 }
@@ -152,9 +165,8 @@ InferenceEngine::CNNNetwork YoloDetection::read() {
     InferenceEngine::CNNNetReader netReader;
     /** Reading network model **/
     netReader.ReadNetwork(this -> commandLineFlag);
-    /** Setting batch size to 1 **/
-    slog::info << "Batch size is forced to  1." << slog::endl;
-    netReader.getNetwork().setBatchSize(1);
+    netReader.getNetwork().setBatchSize(this -> maxBatch);
+    slog::info << "Batch size is set to " << netReader.getNetwork().getBatchSize() << " for " << this -> topoName << slog::endl;
     /** Extracting the model name and loading its weights **/
     std::string binFileName = fileNameNoExt(this -> commandLineFlag) + ".bin";
     netReader.ReadWeights(binFileName);
@@ -195,6 +207,7 @@ InferenceEngine::CNNNetwork YoloDetection::read() {
         a.second->setPrecision(InferenceEngine::Precision::FP32);
         a.second->setLayout(InferenceEngine::Layout::NCHW);
         this -> output.push_back(a.first);
+        this -> outputLayers.emplace_back(netReader.getNetwork().getLayerByName(a.first.c_str()));
     }
     this -> net_readed = netReader.getNetwork();
     // -----------------------------------------------------------------------------------------------------
@@ -206,35 +219,49 @@ void YoloDetection::fetchResults(int inputBatchSize) {
     if (nullptr == this -> outputRequest) {
 	    return;
     }
-    this -> results.clear();
-    
-    std::vector<DetectionObject> objects;
-    // Parsing outputs
-    for (auto && i : this -> output) {
-        InferenceEngine::CNNLayerPtr layer = net_readed.getLayerByName(i.c_str());
-        InferenceEngine::Blob::Ptr blob = outputRequest->GetBlob(i);
-        ParseYOLOV3Output(layer, blob, this -> resized_im_h, this -> resized_im_w, this -> height, this -> width, this -> detection_threshold, objects);
-    }
-    // Filtering overlapping boxes
-    std::sort(objects.begin(), objects.end());
-    for (int i = 0; i < objects.size(); ++i) {
-        if (objects[i].confidence == 0)
-            continue;
-        for (int j = i + 1; j < objects.size(); ++j)
-            if (IntersectionOverUnion(objects[i], objects[j]) >= this ->olb_threshold)
-                objects[j].confidence = 0;
-    }
-    int j = 0;
-    for(auto && i : objects){
-        Result r;
-        if(i.confidence < this -> detection_threshold)
-            continue;
-        r.batchIndex = 0;
-        j++;
-        r.label = i.class_id;
-        r.confidence = i.confidence;
-        r.location = cv::Rect(cv::Point2f(i.xmin,i.ymin), cv::Point2f(i.xmax,i.ymax));
-        this -> results.push_back(r);
+
+    // One list of objects per output scale, parsed in parallel
+    std::vector<std::vector<DetectionObject>> scaleObjects(this -> outputLayers.size());
+    std::vector<std::exception_ptr> errors(this -> outputLayers.size());
+    for (int b = 0; b < inputBatchSize; b++) {
+        const cv::Size& frameSize = this -> outputFrameSizes[b];
+        ThreadPool::shared().parallelFor(0, this -> outputLayers.size(), 1, [&](size_t k) {
+            scaleObjects[k].clear();
+            try {
+                InferenceEngine::Blob::Ptr blob = this -> outputRequest->GetBlob(this -> output[k]);
+                ParseYOLOV3Output(this -> outputLayers[k], blob, b, this -> resized_im_h, this -> resized_im_w, frameSize.height, frameSize.width, this -> detection_threshold, scaleObjects[k]);
+            } catch (...) {
+                errors[k] = std::current_exception();
+            }
+        });
+        std::vector<DetectionObject> objects;
+        for (size_t k = 0; k < scaleObjects.size(); k++) {
+            if (errors[k]) {
+                std::rethrow_exception(errors[k]);
+            }
+            objects.insert(objects.end(), scaleObjects[k].begin(), scaleObjects[k].end());
+        }
+        // Filtering overlapping boxes, within each image and class
+        std::vector<NmsBox> boxes;
+        boxes.reserve(objects.size());
+        for (auto && i : objects) {
+            NmsBox box;
+            box.xmin = i.xmin;
+            box.ymin = i.ymin;
+            box.xmax = i.xmax;
+            box.ymax = i.ymax;
+            box.score = i.confidence;
+            box.label = i.class_id;
+            boxes.push_back(box);
+        }
+        for (auto && k : nonMaximumSuppression(boxes, this -> nms)) {
+            Result r;
+            r.batchIndex = b;
+            r.label = boxes[k].label;
+            r.confidence = boxes[k].score;
+            r.location = cv::Rect(cv::Point2f(boxes[k].xmin, boxes[k].ymin), cv::Point2f(boxes[k].xmax, boxes[k].ymax));
+            this -> results[b].push_back(r);
+        }
     }
     this -> outputRequest = nullptr;
-}
\ No newline at end of file
+}
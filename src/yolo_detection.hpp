@@ -1,4 +1,5 @@
 #include "base_detection.hpp"
+#include "nms.hpp"
 
 #define yolo_scale_13 13
 #define yolo_scale_26 26
@@ -6,8 +7,6 @@
 
 void FrameToBlob(const cv::Mat &frame, InferenceEngine::InferRequest::Ptr &inferRequest, const std::string &inputName);
 
-static int EntryIndex(int side, int lcoords, int lclasses, int location, int entry);
-
 struct DetectionObject {
     int xmin, ymin, xmax, ymax, class_id;
     float confidence;
@@ -26,9 +25,19 @@ struct DetectionObject {
     }
 };
 
-double IntersectionOverUnion(const DetectionObject &box_1, const DetectionObject &box_2);
+// Attributes of a RegionYolo output layer, read once when the network is loaded
+struct RegionYoloParams {
+    std::string name;
+    int num;
+    int coords;
+    int classes;
+    std::vector<float> anchors;
+
+    explicit RegionYoloParams(const InferenceEngine::CNNLayerPtr &layer);
+};
 
-void ParseYOLOV3Output(const InferenceEngine::CNNLayerPtr &layer, const InferenceEngine::Blob::Ptr &blob, const unsigned long resized_im_h,
+// Appends the detections of image batchIndex of the blob to objects
+void ParseYOLOV3Output(const RegionYoloParams &params, const InferenceEngine::Blob::Ptr &blob, const int batchIndex, const unsigned long resized_im_h,
                        const unsigned long resized_im_w, const unsigned long original_im_h,
                        const unsigned long original_im_w,
                        const double threshold, std::vector<DetectionObject> &objects);
@@ -37,18 +46,16 @@ class YoloDetection : public BaseDetection{
   public:
 	std::string input_name;
     std::vector<std::string> output;
+    std::vector<RegionYoloParams> outputLayers;  // Same order as output
     int maxProposalCount = 0;
     int objectSize = 0;
-    int enquedFrames = 0;
     std::vector<std::string> labels;
     float olb_threshold; // overlaping boxes threshold
+    NmsParams nms;       // filtering of the overlapping boxes, per class
     std::vector<DetectionObject> detected_results;
 
     unsigned long resized_im_h = 0;
     unsigned long resized_im_w = 0;
-        
-    float width = 0;
-    float height = 0;
     using BaseDetection::operator=;
 
     // detection_threshold = FLAGS_t; olb_threshold = FLAGS_iou_t
@@ -56,10 +63,11 @@ class YoloDetection : public BaseDetection{
                 int maxBatch, int n_async, bool auto_resize, float detection_threshold, 
                 float olb_threshold) 
                 : BaseDetection(commandLineFlag, deviceName, topoName, maxBatch, n_async, 
-                    auto_resize , detection_threshold), olb_threshold(olb_threshold) {}
+                    auto_resize , detection_threshold), olb_threshold(olb_threshold) {
+        this->nms.iouThreshold = olb_threshold;
+        this->nms.scoreThreshold = detection_threshold;
+    }
     
-    void submitRequest() override;
-
     void enqueue(const cv::Mat &frame) override;
     
     InferenceEngine::CNNNetwork read() override ;
@@ -0,0 +1,112 @@
+// Unit tests of DetectionScheduler, no inference engine or OpenCV needed
+#include <cstdlib>
+#include <iostream>
+
+#include "../src/detection_scheduler.hpp"
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK failed: " #cond << std::endl; \
+            failures++; \
+        } \
+    } while (0)
+
+// Runs key frames without new objects until the interval reaches maxInterval
+static void grow(DetectionScheduler &scheduler, unsigned maxInterval) {
+    for (unsigned i = 0; i < maxInterval * maxInterval && scheduler.getInterval() < maxInterval; i++) {
+        if (scheduler.nextIsKeyFrame()) {
+            scheduler.keyFrameDone(0);
+        }
+        scheduler.frameTracked(100, 0);
+    }
+}
+
+// activity is the mean displacement in one frame relative to the target size
+static void testActivityIsPerFrame() {
+    DetectionScheduler scheduler(8);
+    grow(scheduler, 8);
+    CHECK(scheduler.getInterval() == 8);
+
+    // A 100 px car moving 5 px per frame is 0.05 of its size per frame, not an event
+    scheduler.frameTracked(100, 5.0 / 100);
+    CHECK(scheduler.getInterval() == 8);
+
+    // Right at the threshold is not an event either, only above it
+    scheduler.frameTracked(100, scheduler.highActivity);
+    CHECK(scheduler.getInterval() == 8);
+
+    // Moving more than highActivity of its size per frame halves the interval
+    scheduler.frameTracked(100, scheduler.highActivity * 1.01);
+    CHECK(scheduler.getInterval() == 4);
+    CHECK(scheduler.nextIsKeyFrame());
+}
+
+static void testLowPsr() {
+    DetectionScheduler scheduler(8);
+    grow(scheduler, 8);
+
+    scheduler.frameTracked(scheduler.lowPsr, 0);
+    CHECK(scheduler.getInterval() == 8);
+
+    scheduler.frameTracked(scheduler.lowPsr - 0.1, 0);
+    CHECK(scheduler.getInterval() == 4);
+    CHECK(scheduler.nextIsKeyFrame());
+}
+
+static void testNewObjectsShorten() {
+    DetectionScheduler scheduler(8);
+    grow(scheduler, 8);
+    scheduler.keyFrameDone(1);
+    CHECK(scheduler.getInterval() == 4);
+    scheduler.keyFrameDone(0);
+    CHECK(scheduler.getInterval() == 5);
+}
+
+// The decode side runs ahead: the frames already in flight when an event forces a
+// key frame report the same event again, which must not shorten the interval again
+static void testEventInFlightCountsOnce() {
+    const int depth = 6;
+    DetectionScheduler scheduler(16);
+    grow(scheduler, 16);
+    CHECK(scheduler.getInterval() == 16);
+
+    // depth frames decoded, none tracked yet
+    for (int i = 0; i < depth; i++) {
+        scheduler.nextIsKeyFrame();
+    }
+
+    // The first tracked frame loses a target, the next frame to decode becomes a key frame
+    scheduler.frameTracked(0, 0);
+    CHECK(scheduler.getInterval() == 8);
+    CHECK(scheduler.nextIsKeyFrame());
+
+    // The frames decoded before the forced key frame report the same low PSR
+    int keyFrames = 0;
+    for (int i = 1; i < depth; i++) {
+        scheduler.frameTracked(0, 0);
+        keyFrames += scheduler.nextIsKeyFrame() ? 1 : 0;
+    }
+    CHECK(scheduler.getInterval() == 8);
+    CHECK(keyFrames == 0);
+
+    // The forced key frame itself reports again, that is a new event
+    scheduler.frameTracked(0, 0);
+    CHECK(scheduler.getInterval() == 4);
+    CHECK(scheduler.nextIsKeyFrame());
+}
+
+int main() {
+    testActivityIsPerFrame();
+    testLowPsr();
+    testNewObjectsShorten();
+    testEventInFlightCountsOnce();
+    if (failures != 0) {
+        std::cerr << failures << " check(s) failed" << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << "detection_scheduler_test passed" << std::endl;
+    return EXIT_SUCCESS;
+}
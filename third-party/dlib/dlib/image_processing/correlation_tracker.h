@@ -9,6 +9,8 @@
 #include "../array2d.h"
 #include "../image_transforms/assign_image.h"
 #include "../image_transforms/interpolation.h"
+#include "../simd/simd_check.h"
+#include <memory>
 
 
 namespace dlib
@@ -16,11 +18,288 @@ namespace dlib
 
 // ----------------------------------------------------------------------------------------
 
-    class correlation_tracker
+    namespace impl
     {
+        /*
+            Element-wise kernels for the spectra of the correlation tracker.  They work on
+            contiguous arrays of n elements so the filter updates don't build any matrix
+            expression temporaries.  The float versions are vectorized with AVX or SSE3
+            when available, the double versions are plain loops.
+        */
+
+        template <typename T>
+        inline void correlate_accumulate (
+            const std::complex<T>* f,
+            const std::complex<T>* a,
+            std::complex<T>* g,
+            long n
+        )
+        /*!
+            ensures
+                - #g[k] == g[k] + f[k]*conj(a[k])
+        !*/
+        {
+            for (long k = 0; k < n; ++k)
+            {
+                const T fr = f[k].real(), fi = f[k].imag();
+                const T ar = a[k].real(), ai = a[k].imag();
+                g[k] = std::complex<T>(g[k].real() + fr*ar + fi*ai, g[k].imag() + fi*ar - fr*ai);
+            }
+        }
+
+        template <typename T>
+        inline void divide_by_energy (
+            std::complex<T>* g,
+            const T* b,
+            const T lambda,
+            long n
+        )
+        /*!
+            ensures
+                - #g[k] == g[k]/(b[k]+lambda)
+        !*/
+        {
+            for (long k = 0; k < n; ++k)
+                g[k] *= 1/(b[k]+lambda);
+        }
+
+        template <typename T>
+        inline void update_filter (
+            const std::complex<T>* g,
+            const std::complex<T>* f,
+            std::complex<T>* a,
+            T* b,
+            const T nu,
+            long n
+        )
+        /*!
+            ensures
+                - #a[k] == nu*g[k]*f[k] + (1-nu)*a[k]
+                - #b[k] == b[k] + nu*norm(f[k])
+        !*/
+        {
+            for (long k = 0; k < n; ++k)
+            {
+                const T fr = f[k].real(), fi = f[k].imag();
+                const T gr = g[k].real(), gi = g[k].imag();
+                a[k] = std::complex<T>(nu*(gr*fr - gi*fi) + (1-nu)*a[k].real(),
+                                       nu*(gr*fi + gi*fr) + (1-nu)*a[k].imag());
+                b[k] += nu*(fr*fr + fi*fi);
+            }
+        }
+
+        template <typename T>
+        inline void moments (
+            const T* g,
+            long n,
+            double& sum,
+            double& sum_sqr
+        )
+        /*!
+            ensures
+                - #sum == sum + the sum of g[k]
+                - #sum_sqr == sum_sqr + the sum of g[k]^2
+        !*/
+        {
+            for (long k = 0; k < n; ++k)
+            {
+                const double v = g[k];
+                sum += v;
+                sum_sqr += v*v;
+            }
+        }
+
+#if defined(DLIB_HAVE_SSE3)
+        /*
+            An __m128 holds 2 complex values laid out as (re0, im0, re1, im1).
+        */
+
+        // returns x*y
+        inline __m128 complex_mul (__m128 x, __m128 y)
+        {
+            const __m128 t1 = _mm_mul_ps(x, _mm_moveldup_ps(y));
+            const __m128 t2 = _mm_mul_ps(_mm_shuffle_ps(x,x,_MM_SHUFFLE(2,3,0,1)), _mm_movehdup_ps(y));
+            return _mm_addsub_ps(t1, t2);
+        }
+
+        // returns x*conj(y)
+        inline __m128 complex_mul_conj (__m128 x, __m128 y)
+        {
+            const __m128 t1 = _mm_mul_ps(x, _mm_moveldup_ps(y));
+            const __m128 t2 = _mm_mul_ps(_mm_shuffle_ps(x,x,_MM_SHUFFLE(2,3,0,1)), _mm_movehdup_ps(y));
+            // (re, im) = t1 + (t2_re, -t2_im)
+            return _mm_add_ps(t1, _mm_xor_ps(t2, _mm_set_ps(-0.f, 0.f, -0.f, 0.f)));
+        }
+
+        // returns (norm(x0), norm(x1), norm(y0), norm(y1))
+        inline __m128 complex_norm (__m128 x, __m128 y)
+        {
+            return _mm_hadd_ps(_mm_mul_ps(x,x), _mm_mul_ps(y,y));
+        }
+#endif
+
+#if defined(DLIB_HAVE_AVX)
+        /*
+            An __m256 holds 4 complex values laid out as (re0, im0, ..., re3, im3).
+        */
+
+        inline __m256 complex_mul (__m256 x, __m256 y)
+        {
+            const __m256 t1 = _mm256_mul_ps(x, _mm256_moveldup_ps(y));
+            const __m256 t2 = _mm256_mul_ps(_mm256_permute_ps(x, _MM_SHUFFLE(2,3,0,1)), _mm256_movehdup_ps(y));
+            return _mm256_addsub_ps(t1, t2);
+        }
+
+        inline __m256 complex_mul_conj (__m256 x, __m256 y)
+        {
+            const __m256 t1 = _mm256_mul_ps(x, _mm256_moveldup_ps(y));
+            const __m256 t2 = _mm256_mul_ps(_mm256_permute_ps(x, _MM_SHUFFLE(2,3,0,1)), _mm256_movehdup_ps(y));
+            return _mm256_add_ps(t1, _mm256_xor_ps(t2, _mm256_set_ps(-0.f, 0.f, -0.f, 0.f, -0.f, 0.f, -0.f, 0.f)));
+        }
+
+        // returns the norms of the 8 complex values in x and y, in order
+        inline __m256 complex_norm (__m256 x, __m256 y)
+        {
+            const __m256 xx = _mm256_mul_ps(x,x);
+            const __m256 yy = _mm256_mul_ps(y,y);
+            // hadd works within 128 bit lanes, so pair up the lanes first.
+            const __m256 lo = _mm256_permute2f128_ps(xx, yy, 0x20);
+            const __m256 hi = _mm256_permute2f128_ps(xx, yy, 0x31);
+            return _mm256_hadd_ps(lo, hi);
+        }
+#endif
+
+#if defined(DLIB_HAVE_SSE3)
+        inline void correlate_accumulate (
+            const std::complex<float>* f,
+            const std::complex<float>* a,
+            std::complex<float>* g,
+            long n
+        )
+        {
+            float* pg = reinterpret_cast<float*>(g);
+            const float* pf = reinterpret_cast<const float*>(f);
+            const float* pa = reinterpret_cast<const float*>(a);
+            long k = 0;
+#if defined(DLIB_HAVE_AVX)
+            for (; k+4 <= n; k += 4)
+            {
+                const __m256 v = complex_mul_conj(_mm256_loadu_ps(pf+2*k), _mm256_loadu_ps(pa+2*k));
+                _mm256_storeu_ps(pg+2*k, _mm256_add_ps(_mm256_loadu_ps(pg+2*k), v));
+            }
+#endif
+            for (; k+2 <= n; k += 2)
+            {
+                const __m128 v = complex_mul_conj(_mm_loadu_ps(pf+2*k), _mm_loadu_ps(pa+2*k));
+                _mm_storeu_ps(pg+2*k, _mm_add_ps(_mm_loadu_ps(pg+2*k), v));
+            }
+            correlate_accumulate<float>(f+k, a+k, g+k, n-k);
+        }
+
+        inline void divide_by_energy (
+            std::complex<float>* g,
+            const float* b,
+            const float lambda,
+            long n
+        )
+        {
+            float* pg = reinterpret_cast<float*>(g);
+            const __m128 l4 = _mm_set1_ps(lambda);
+            const __m128 one = _mm_set1_ps(1);
+            long k = 0;
+            for (; k+4 <= n; k += 4)
+            {
+                const __m128 r = _mm_div_ps(one, _mm_add_ps(_mm_loadu_ps(b+k), l4));
+                _mm_storeu_ps(pg+2*k,   _mm_mul_ps(_mm_loadu_ps(pg+2*k),   _mm_unpacklo_ps(r,r)));
+                _mm_storeu_ps(pg+2*k+4, _mm_mul_ps(_mm_loadu_ps(pg+2*k+4), _mm_unpackhi_ps(r,r)));
+            }
+            divide_by_energy<float>(g+k, b+k, lambda, n-k);
+        }
+
+        inline void update_filter (
+            const std::complex<float>* g,
+            const std::complex<float>* f,
+            std::complex<float>* a,
+            float* b,
+            const float nu,
+            long n
+        )
+        {
+            const float* pg = reinterpret_cast<const float*>(g);
+            const float* pf = reinterpret_cast<const float*>(f);
+            float* pa = reinterpret_cast<float*>(a);
+            long k = 0;
+#if defined(DLIB_HAVE_AVX)
+            const __m256 nu8 = _mm256_set1_ps(nu);
+            const __m256 rnu8 = _mm256_set1_ps(1-nu);
+            for (; k+8 <= n; k += 8)
+            {
+                const __m256 f0 = _mm256_loadu_ps(pf+2*k);
+                const __m256 f1 = _mm256_loadu_ps(pf+2*k+8);
+                const __m256 a0 = _mm256_add_ps(_mm256_mul_ps(nu8, complex_mul(_mm256_loadu_ps(pg+2*k), f0)),
+                                                _mm256_mul_ps(rnu8, _mm256_loadu_ps(pa+2*k)));
+                const __m256 a1 = _mm256_add_ps(_mm256_mul_ps(nu8, complex_mul(_mm256_loadu_ps(pg+2*k+8), f1)),
+                                                _mm256_mul_ps(rnu8, _mm256_loadu_ps(pa+2*k+8)));
+                _mm256_storeu_ps(pa+2*k, a0);
+                _mm256_storeu_ps(pa+2*k+8, a1);
+                _mm256_storeu_ps(b+k, _mm256_add_ps(_mm256_loadu_ps(b+k), _mm256_mul_ps(nu8, complex_norm(f0, f1))));
+            }
+#endif
+            const __m128 nu4 = _mm_set1_ps(nu);
+            const __m128 rnu4 = _mm_set1_ps(1-nu);
+            for (; k+4 <= n; k += 4)
+            {
+                const __m128 f0 = _mm_loadu_ps(pf+2*k);
+                const __m128 f1 = _mm_loadu_ps(pf+2*k+4);
+                const __m128 a0 = _mm_add_ps(_mm_mul_ps(nu4, complex_mul(_mm_loadu_ps(pg+2*k), f0)),
+                                             _mm_mul_ps(rnu4, _mm_loadu_ps(pa+2*k)));
+                const __m128 a1 = _mm_add_ps(_mm_mul_ps(nu4, complex_mul(_mm_loadu_ps(pg+2*k+4), f1)),
+                                             _mm_mul_ps(rnu4, _mm_loadu_ps(pa+2*k+4)));
+                _mm_storeu_ps(pa+2*k, a0);
+                _mm_storeu_ps(pa+2*k+4, a1);
+                _mm_storeu_ps(b+k, _mm_add_ps(_mm_loadu_ps(b+k), _mm_mul_ps(nu4, complex_norm(f0, f1))));
+            }
+            update_filter<float>(g+k, f+k, a+k, b+k, nu, n-k);
+        }
+
+        inline void moments (
+            const float* g,
+            long n,
+            double& sum,
+            double& sum_sqr
+        )
+        {
+            __m128 s = _mm_setzero_ps();
+            __m128 ss = _mm_setzero_ps();
+            long k = 0;
+            for (; k+4 <= n; k += 4)
+            {
+                const __m128 v = _mm_loadu_ps(g+k);
+                s = _mm_add_ps(s, v);
+                ss = _mm_add_ps(ss, _mm_mul_ps(v,v));
+            }
+            float temp[4];
+            _mm_storeu_ps(temp, s);
+            sum += (double)temp[0] + temp[1] + temp[2] + temp[3];
+            _mm_storeu_ps(temp, ss);
+            sum_sqr += (double)temp[0] + temp[1] + temp[2] + temp[3];
+            moments<float>(g+k, n-k, sum, sum_sqr);
+        }
+#endif
+    }
+
+// ----------------------------------------------------------------------------------------
+
+    template <typename T>
+    class basic_correlation_tracker
+    {
+        COMPILE_TIME_ASSERT((is_same_type<T,float>::value || is_same_type<T,double>::value));
+
     public:
 
-        explicit correlation_tracker (unsigned long filter_size = 6, 
+        typedef T value_type;
+
+        explicit basic_correlation_tracker (unsigned long filter_size = 6, 
             unsigned long num_scale_levels = 5, 
             unsigned long scale_window_size = 23,
             double regularizer_space = 0.001,
@@ -38,6 +317,11 @@ namespace dlib
             // Create the cosine mask used for space filtering.
             mask = make_cosine_mask();
 
+            // The transforms always have the same sizes, so their plans are shared by
+            // every tracker.
+            space_plan = &get_fft_plan<T>(get_filter_size(), get_filter_size());
+            scale_plan = &get_fft_plan<T>(get_num_scale_levels(), 1);
+
             // Create the cosine mask used for the scale filtering.
             scale_cos_mask.resize(get_num_scale_levels());
             const long max_level = get_num_scale_levels()/2;
@@ -56,36 +340,36 @@ namespace dlib
         )
         {
             DLIB_CASSERT(p.is_empty() == false,
-                "\t void correlation_tracker::start_track()"
+                "\t void basic_correlation_tracker::start_track()"
                 << "\n\t You can't give an empty rectangle."
             );
 
-            B.set_size(0,0);
-
             point_transform_affine tform = inv(make_chip(img, p, F));
-            for (unsigned long i = 0; i < F.size(); ++i)
-                fft_inplace(F[i]);
-            make_target_location_image(tform(center(p)), G);
+            const matrix<std::complex<T> >& g = target_location_spectrum(tform(center(p)));
             A.resize(F.size());
+            B.set_size(g.nr(), g.nc());
+            B = 0;
             for (unsigned long i = 0; i < F.size(); ++i)
             {
-                A[i] = pointwise_multiply(G, F[i]);
-                B += squared(real(F[i]))+squared(imag(F[i]));
+                // With nu == 1 the old value of A[i] doesn't matter.
+                A[i].set_size(F[i].nr(), F[i].nc());
+                A[i] = 0;
+                impl::update_filter(&g(0,0), &F[i](0,0), &A[i](0,0), &B(0,0), (T)1, g.size());
             }
 
             position = p;
 
             // now do the scale space stuff
             make_scale_space(img, Fs);
-            for (unsigned long i = 0; i < Fs.size(); ++i)
-                fft_inplace(Fs[i]);
             make_scale_target_location_image(get_num_scale_levels()/2, Gs);
-            Bs.set_size(0);
             As.resize(Fs.size());
+            Bs.set_size(Gs.size());
+            Bs = 0;
             for (unsigned long i = 0; i < Fs.size(); ++i)
             {
-                As[i] = pointwise_multiply(Gs, Fs[i]);
-                Bs += squared(real(Fs[i]))+squared(imag(Fs[i]));
+                As[i].set_size(Fs[i].size());
+                As[i] = 0;
+                impl::update_filter(&Gs(0), &Fs[i](0), &As[i](0), &Bs(0), (T)1, Gs.size());
             }
         }
 
@@ -131,49 +415,49 @@ namespace dlib
         )
         {
             DLIB_CASSERT(get_position().is_empty() == false,
-                "\t double correlation_tracker::update()"
+                "\t double basic_correlation_tracker::update()"
                 << "\n\t You must call start_track() first before calling update()."
             );
 
 
             const point_transform_affine tform = make_chip(img, guess, F);
-            for (unsigned long i = 0; i < F.size(); ++i)
-                fft_inplace(F[i]);
 
             // use the current filter to predict the object's location
+            G.set_size(space_plan->half_nr(), space_plan->half_nc());
             G = 0;
             for (unsigned long i = 0; i < F.size(); ++i)
-                G += pointwise_multiply(F[i],conj(A[i]));
-            G = pointwise_multiply(G, reciprocal(B+get_regularizer_space()));
-            ifft_inplace(G);
-            const dlib::vector<double,2> pp = max_point_interpolated(real(G));
+                impl::correlate_accumulate(&F[i](0,0), &A[i](0,0), &G(0,0), G.size());
+            impl::divide_by_energy(&G(0,0), &B(0,0), (T)get_regularizer_space(), G.size());
+            space_plan->backward_half(G, response);
+            const dlib::vector<double,2> pp = max_point_interpolated(response);
 
 
-            // Compute the peak to side lobe ratio.
+            // Compute the peak to side lobe ratio.  Take the moments of the whole
+            // response and remove the part that falls inside the peak area.
             const point p = pp;
-            running_stats<double> rs;
-            const rectangle peak = centered_rect(p, 8,8);
-            for (long r = 0; r < G.nr(); ++r)
+            const rectangle peak = centered_rect(p, 8,8).intersect(get_rect(response));
+            double sum = 0, sum_sqr = 0;
+            impl::moments(&response(0,0), response.size(), sum, sum_sqr);
+            for (long r = peak.top(); r <= peak.bottom(); ++r)
             {
-                for (long c = 0; c < G.nc(); ++c)
-                {
-                    if (!peak.contains(point(c,r)))
-                        rs.add(G(r,c).real());
-                }
+                double peak_sum = 0, peak_sum_sqr = 0;
+                impl::moments(&response(r,peak.left()), peak.width(), peak_sum, peak_sum_sqr);
+                sum -= peak_sum;
+                sum_sqr -= peak_sum_sqr;
             }
-            const double psr = (G(p.y(),p.x()).real()-rs.mean())/rs.stddev();
+            const double n = response.size() - peak.area();
+            const double mean = sum/n;
+            const double stddev = std::sqrt(std::max(0.0, (sum_sqr - n*mean*mean)/(n-1)));
+            const double psr = (response(p.y(),p.x())-mean)/stddev;
 
             // update the position of the object
             position = translate_rect(guess, tform(pp)-center(guess));
 
             // now update the position filters
-            make_target_location_image(pp, G);
+            const matrix<std::complex<T> >& g = target_location_spectrum(pp);
             B *= (1-get_nu_space());
             for (unsigned long i = 0; i < F.size(); ++i)
-            {
-                A[i] = get_nu_space()*pointwise_multiply(G, F[i]) + (1-get_nu_space())*A[i];
-                B += get_nu_space()*(squared(real(F[i]))+squared(imag(F[i])));
-            }
+                impl::update_filter(&g(0,0), &F[i](0,0), &A[i](0,0), &B(0,0), (T)get_nu_space(), g.size());
 
             return psr;
         }
@@ -185,17 +469,29 @@ namespace dlib
         )
         {
             double psr = update_noscale(img, guess);
+            update_scale(img);
+            return psr;
+        }
+
+        template <typename image_type>
+        void update_scale (
+            const image_type& img
+        )
+        {
+            DLIB_CASSERT(get_position().is_empty() == false,
+                "\t void basic_correlation_tracker::update_scale()"
+                << "\n\t You must call start_track() first before calling update_scale()."
+            );
 
             // Now predict the scale change
             make_scale_space(img, Fs);
-            for (unsigned long i = 0; i < Fs.size(); ++i)
-                fft_inplace(Fs[i]);
+            Gs.set_size(scale_plan->half_nr());
             Gs = 0;
             for (unsigned long i = 0; i < Fs.size(); ++i)
-                Gs += pointwise_multiply(Fs[i],conj(As[i]));
-            Gs = pointwise_multiply(Gs, reciprocal(Bs+get_regularizer_scale()));
-            ifft_inplace(Gs);
-            const double pos = max_point_interpolated(real(Gs)).y();
+                impl::correlate_accumulate(&Fs[i](0), &As[i](0), &Gs(0), Gs.size());
+            impl::divide_by_energy(&Gs(0), &Bs(0), (T)get_regularizer_scale(), Gs.size());
+            scale_plan->backward_half(Gs, scale_response);
+            const double pos = max_point_interpolated(scale_response).y();
 
             // update the rectangle's scale
             position *= std::pow(get_scale_pyramid_alpha(), pos-(double)get_num_scale_levels()/2);
@@ -206,13 +502,7 @@ namespace dlib
             make_scale_target_location_image(pos, Gs);
             Bs *= (1-get_nu_scale());
             for (unsigned long i = 0; i < Fs.size(); ++i)
-            {
-                As[i] = get_nu_scale()*pointwise_multiply(Gs, Fs[i]) + (1-get_nu_scale())*As[i];
-                Bs += get_nu_scale()*(squared(real(Fs[i]))+squared(imag(Fs[i])));
-            }
-
-
-            return psr;
+                impl::update_filter(&Gs(0), &Fs[i](0), &As[i](0), &Bs(0), (T)get_nu_scale(), Gs.size());
         }
 
         template <typename image_type>
@@ -236,7 +526,7 @@ namespace dlib
         template <typename image_type>
         void make_scale_space(
             const image_type& img,
-            std::vector<matrix<std::complex<double>,0,1> >& Fs
+            std::vector<matrix<std::complex<T>,0,1> >& Fs
         ) const
         {
             typedef typename image_traits<image_type>::pixel_type pixel_type;
@@ -244,29 +534,27 @@ namespace dlib
             // Make an image pyramid and put it into the chips array.
             const long chip_size = get_scale_window_size();
             drectangle ppp = position*std::pow(get_scale_pyramid_alpha(), -(double)get_num_scale_levels()/2);
-            dlib::array<array2d<pixel_type> > chips;
-            std::vector<dlib::vector<double,2> > from_points, to_points;
-            from_points.push_back(point(0,0));
-            from_points.push_back(point(chip_size-1,0));
-            from_points.push_back(point(chip_size-1,chip_size-1));
+            image_workspace<pixel_type>& ws = workspace.template get<pixel_type>();
+            dlib::array<array2d<pixel_type> >& chips = ws.scale_chips;
+            chips.resize(get_num_scale_levels());
             for (unsigned long i = 0; i < get_num_scale_levels(); ++i)
             {
-                array2d<pixel_type> chip(chip_size,chip_size);
+                chips[i].set_size(chip_size,chip_size);
 
-                // pull box into chip
-                to_points.clear();
-                to_points.push_back(ppp.tl_corner());
-                to_points.push_back(ppp.tr_corner());
-                to_points.push_back(ppp.br_corner());
-                transform_image(img,chip,interpolate_bilinear(),find_affine_transform(from_points, to_points));
+                // pull box into chip.  This maps the chip corners (0,0), (chip_size-1,0)
+                // and (chip_size-1,chip_size-1) to the tl, tr and br corners of the box.
+                matrix<double,2,2> m;
+                m = (ppp.tr_corner().x()-ppp.tl_corner().x())/(chip_size-1), 0,
+                    0, (ppp.br_corner().y()-ppp.tr_corner().y())/(chip_size-1);
+                transform_image(img,chips[i],interpolate_bilinear(),point_transform_affine(m, ppp.tl_corner()));
 
-                chips.push_back(chip);
                 ppp *= get_scale_pyramid_alpha();
             }
 
 
             // extract HOG for each chip
-            dlib::array<dlib::array<array2d<float> > > hogs(chips.size());
+            dlib::array<dlib::array<array2d<float> > >& hogs = ws.scale_hogs;
+            hogs.resize(chips.size());
             for (unsigned long i = 0; i < chips.size(); ++i)
             {
                 extract_fhog_features(chips[i], hogs[i], 4);
@@ -275,9 +563,11 @@ namespace dlib
                 assign_image(hogs[i][31], mat(hogs[i][31])/255.0);
             }
 
-            // Now copy the hog features into the Fs outputs and also apply the cosine
-            // windowing.
+            // Now copy the hog features into the Fs outputs, apply the cosine
+            // windowing, and transform them.
             Fs.resize(hogs[0].size()*hogs[0][0].size());
+            matrix<T,0,1>& feature = workspace.scale_feature();
+            feature.set_size(hogs.size());
             unsigned long i = 0; 
             for (long r = 0; r < hogs[0][0].nr(); ++r)
             {
@@ -285,11 +575,11 @@ namespace dlib
                 {
                     for (unsigned long j = 0; j < hogs[0].size(); ++j)
                     {
-                        Fs[i].set_size(hogs.size());
                         for (unsigned long k = 0; k < hogs.size(); ++k)
                         {
-                            Fs[i](k) = hogs[k][j][r][c]*scale_cos_mask[k];
+                            feature(k) = hogs[k][j][r][c]*scale_cos_mask[k];
                         }
+                        scale_plan->forward_half(feature, Fs[i]);
                         ++i;
                     }
                 }
@@ -300,69 +590,118 @@ namespace dlib
         point_transform_affine make_chip (
             const image_type& img,
             drectangle p,
-            std::vector<matrix<std::complex<double> > >& chip
+            std::vector<matrix<std::complex<T> > >& chip
         ) const
+        /*!
+            ensures
+                - #chip == the half spectra of the windowed feature channels of the chip
+                  around p.
+                - returns the mapping from chip to image coordinates.
+        !*/
         {
             typedef typename image_traits<image_type>::pixel_type pixel_type;
-            array2d<pixel_type> temp;
+            image_workspace<pixel_type>& ws = workspace.template get<pixel_type>();
+            array2d<pixel_type>& temp = ws.chip;
             const double padding = 1.4;
             const chip_details details(p*padding, chip_dims(get_filter_size(), get_filter_size()));
             extract_image_chip(img, details, temp);
 
 
+            // The features are real, so only half of their spectra is kept.
             chip.resize(32);
-            dlib::array<array2d<float> > hog;
+            dlib::array<array2d<float> >& hog = ws.hog;
+            matrix<T>& feature = workspace.feature();
             extract_fhog_features(temp, hog, 1, 3,3 );
             for (unsigned long i = 0; i < hog.size(); ++i)
-                assign_image(chip[i], pointwise_multiply(matrix_cast<double>(mat(hog[i])), mask));
+            {
+                feature = pointwise_multiply(matrix_cast<T>(mat(hog[i])), mask);
+                space_plan->forward_half(feature, chip[i]);
+            }
 
-            assign_image(chip[31], temp);
-            assign_image(chip[31], pointwise_multiply(mat(chip[31]), mask)/255.0);
+            assign_image(feature, temp);
+            feature = pointwise_multiply(feature, mask)/(T)255;
+            space_plan->forward_half(feature, chip[31]);
 
             return inv(get_mapping_to_chip(details));
         }
 
+        const matrix<std::complex<T> >& target_location_spectrum (
+            const dlib::vector<double,2>& p
+        ) const
+        /*!
+            ensures
+                - returns the conjugated spectrum of a gaussian peak at p.  p is snapped to
+                  a 1/target_spectrum_steps pixel grid and the spectra of the last few
+                  positions are kept, since targets that barely move keep asking for the
+                  same ones.
+        !*/
+        {
+            const dlib::vector<double,2> q(std::floor(p.x()*target_spectrum_steps + 0.5)/target_spectrum_steps,
+                                           std::floor(p.y()*target_spectrum_steps + 0.5)/target_spectrum_steps);
+
+            target_spectrum_cache& cache = workspace.spectra();
+            target_spectrum* lru = &cache.entries[0];
+            for (unsigned long i = 0; i < target_spectrum_cache::size; ++i)
+            {
+                target_spectrum& entry = cache.entries[i];
+                if (entry.last_use != 0 && entry.position == q)
+                {
+                    entry.last_use = ++cache.clock;
+                    return entry.spectrum;
+                }
+                if (entry.last_use < lru->last_use)
+                    lru = &entry;
+            }
+
+            make_target_location_image(q, lru->spectrum);
+            lru->position = q;
+            lru->last_use = ++cache.clock;
+            return lru->spectrum;
+        }
+
         void make_target_location_image (
             const dlib::vector<double,2>& p,
-            matrix<std::complex<double> >& g
+            matrix<std::complex<T> >& g
         ) const
         {
-            g.set_size(get_filter_size(), get_filter_size());
-            g = 0;
-            rectangle area = centered_rect(p, 21,21).intersect(get_rect(g));
+            matrix<T>& temp = workspace.feature();
+            temp.set_size(get_filter_size(), get_filter_size());
+            temp = 0;
+            rectangle area = centered_rect(p, 21,21).intersect(get_rect(temp));
             for (long r = area.top(); r <= area.bottom(); ++r)
             {
                 for (long c = area.left(); c <= area.right(); ++c)
                 {
                     double dist = length(point(c,r)-p);
-                    g(r,c) = std::exp(-dist/3.0);
+                    temp(r,c) = (T)std::exp(-dist/3.0);
                 }
             }
-            fft_inplace(g);
+            space_plan->forward_half(temp, g);
             g = conj(g);
         }
 
 
         void make_scale_target_location_image (
             const double scale,
-            matrix<std::complex<double>,0,1>& g
+            matrix<std::complex<T>,0,1>& g
         ) const
         {
-            g.set_size(get_num_scale_levels());
-            for (long i = 0; i < g.size(); ++i)
+            matrix<T,0,1>& temp = workspace.scale_feature();
+            temp.set_size(get_num_scale_levels());
+            for (long i = 0; i < temp.size(); ++i)
             {
                 double dist = std::pow((i-scale),2.0);
-                g(i) = std::exp(-dist/1.000);
+                temp(i) = (T)std::exp(-dist/1.000);
             }
-            fft_inplace(g);
+            scale_plan->forward_half(temp, g);
             g = conj(g);
         }
 
-        matrix<double> make_cosine_mask (
+        matrix<T> make_cosine_mask (
         ) const
         {
             const long size = get_filter_size();
-            matrix<double> temp(size,size);
+            matrix<T> temp(size,size);
             point cent = center(get_rect(temp));
             for (long r = 0; r < temp.nr(); ++r)
             {
@@ -379,20 +718,99 @@ namespace dlib
         }
 
 
-        std::vector<matrix<std::complex<double> > > A, F;
-        matrix<double> B;
+        std::vector<matrix<std::complex<T> > > A, F;
+        matrix<T> B;
 
-        std::vector<matrix<std::complex<double>,0,1> > As, Fs;
-        matrix<double,0,1> Bs;
+        std::vector<matrix<std::complex<T>,0,1> > As, Fs;
+        matrix<T,0,1> Bs;
         drectangle position;
 
-        matrix<double> mask;
+        matrix<T> mask;
         std::vector<double> scale_cos_mask;
 
-        // G and Gs do not logically contribute to the state of this object.  They are
-        // here just so we can void reallocating them over and over.
-        matrix<std::complex<double> > G;
-        matrix<std::complex<double>,0,1> Gs;
+        // G, Gs and the responses do not logically contribute to the state of this
+        // object.  They are here just so we can void reallocating them over and over.
+        matrix<std::complex<T> > G;
+        matrix<std::complex<T>,0,1> Gs;
+        matrix<T> response;
+        matrix<T,0,1> scale_response;
+
+        // The same goes for the scratch images and the target spectra below.  The scratch
+        // images have the pixel type of the tracked images, so they are type erased, and
+        // copies of the tracker start with an empty workspace.
+        static const long target_spectrum_steps = 8;
+
+        struct target_spectrum
+        {
+            target_spectrum() : last_use(0) {}
+            dlib::vector<double,2> position;
+            matrix<std::complex<T> > spectrum;
+            unsigned long last_use;
+        };
+
+        struct target_spectrum_cache
+        {
+            target_spectrum_cache() : clock(0) {}
+            static const unsigned long size = 4;
+            target_spectrum entries[size];
+            unsigned long clock;
+        };
+
+        struct image_workspace_base
+        {
+            virtual ~image_workspace_base() {}
+            dlib::array<array2d<float> > hog;
+            dlib::array<dlib::array<array2d<float> > > scale_hogs;
+        };
+
+        template <typename pixel_type>
+        struct image_workspace : public image_workspace_base
+        {
+            array2d<pixel_type> chip;
+            dlib::array<array2d<pixel_type> > scale_chips;
+        };
+
+        class workspace_holder
+        {
+        public:
+            workspace_holder() {}
+            workspace_holder(const workspace_holder&) {}
+            workspace_holder& operator= (const workspace_holder&) { return *this; }
+
+            template <typename pixel_type>
+            image_workspace<pixel_type>& get (
+            )
+            {
+                image_workspace<pixel_type>* ws = dynamic_cast<image_workspace<pixel_type>*>(images.get());
+                if (ws == 0)
+                {
+                    ws = new image_workspace<pixel_type>();
+                    images.reset(ws);
+                }
+                return *ws;
+            }
+
+            target_spectrum_cache& spectra (
+            ) { return cache; }
+
+            // Real inputs of the transforms
+            matrix<T>& feature (
+            ) { return feature_buffer; }
+
+            matrix<T,0,1>& scale_feature (
+            ) { return scale_feature_buffer; }
+
+        private:
+            std::unique_ptr<image_workspace_base> images;
+            target_spectrum_cache cache;
+            matrix<T> feature_buffer;
+            matrix<T,0,1> scale_feature_buffer;
+        };
+
+        mutable workspace_holder workspace;
+
+        const fft_plan<T>* space_plan;
+        const fft_plan<T>* scale_plan;
 
         unsigned long filter_size;
         unsigned long num_scale_levels;
@@ -403,6 +821,14 @@ namespace dlib
         double nu_scale;
         double scale_pyramid_alpha;
     };
+
+// ----------------------------------------------------------------------------------------
+
+    typedef basic_correlation_tracker<double> correlation_tracker;
+    typedef basic_correlation_tracker<float> correlation_tracker_float;
+
+// ----------------------------------------------------------------------------------------
+
 }
 
 #endif // DLIB_CORRELATION_TrACKER_H_
@@ -10,9 +10,17 @@ namespace dlib
 
 // ----------------------------------------------------------------------------------------
 
-    class correlation_tracker
+    template <
+        typename T
+        >
+    class basic_correlation_tracker
     {
         /*!
+            REQUIREMENTS ON T
+                T is float or double.  It is the precision the feature spectra and
+                filters are stored and transformed in.  The float version is vectorized
+                with SSE3/AVX when those are enabled and is about as accurate.
+
             WHAT THIS OBJECT REPRESENTS
                 This is a tool for tracking moving objects in a video stream.  You give it
                 the bounding box of an object in the first frame and it attempts to track the
@@ -25,7 +33,7 @@ namespace dlib
 
     public:
 
-        explicit correlation_tracker (unsigned long filter_size = 6, 
+        explicit basic_correlation_tracker (unsigned long filter_size = 6, 
             unsigned long num_scale_levels = 5, 
             unsigned long scale_window_size = 23,
             double regularizer_space = 0.001,
@@ -122,6 +130,27 @@ namespace dlib
                   Larger values indicate higher confidence.
         !*/
 
+        template <
+            typename image_type
+            >
+        void update_scale (
+            const image_type& img
+        );
+        /*!
+            requires
+                - image_type == an image object that implements the interface defined in
+                  dlib/image_processing/generic_image.h 
+                - get_position().is_empty() == false
+                  (i.e. you must have started tracking by calling start_track())
+            ensures
+                - Estimates the scale of the object around get_position() in img, without
+                  moving it.  update(img,guess) is the same as update_noscale(img,guess)
+                  followed by update_scale(img), so callers can run the costly scale
+                  estimation only on some frames.
+                - #get_position() == get_position() scaled about its center so that it,
+                  hopefully, bounds the object in img.
+        !*/
+
         template <
             typename image_type
             >
@@ -154,6 +183,10 @@ namespace dlib
         !*/
 
     };
+
+    typedef basic_correlation_tracker<double> correlation_tracker;
+    typedef basic_correlation_tracker<float> correlation_tracker_float;
+
 }
 
 #endif // DLIB_CORRELATION_TrACKER_ABSTRACT_H_
@@ -7,6 +7,11 @@
 #include "matrix_utilities.h"
 #include "../hash.h"
 #include "../algs.h"
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 #ifdef DLIB_USE_MKL_FFT
 #include <mkl_dfti.h>
@@ -129,33 +134,59 @@ namespace dlib
                 // Compute the twiddle factors for this p value if we haven't done so
                 // already.
                 if (data[p].size() == 0)
-                {
-                    const int nxtlt = 0x1 << p;
-                    data[p].reserve(nxtlt*7);
-                    const T twopi = 6.2831853071795865; /* 2.0 * pi */
-                    const T scale = twopi/(nxtlt*8.0);
-                    std::complex<T> cs[7];
-                    for (int j = 0; j < nxtlt; ++j)
-                    {
-                        const T arg = j*scale;
-                        cs[0] = std::complex<T>(std::cos(arg),std::sin(arg));
-                        cs[1] = cs[0]*cs[0];
-                        cs[2] = cs[1]*cs[0];
-                        cs[3] = cs[1]*cs[1];
-                        cs[4] = cs[2]*cs[1];
-                        cs[5] = cs[2]*cs[2];
-                        cs[6] = cs[3]*cs[2];
-                        data[p].insert(data[p].end(), cs, cs+7);
-                    }
-                }
+                    append_twiddles(p, data[p]);
 
                 return &data[p][0];
             }
 
+            static void append_twiddles (
+                int p,
+                std::vector<std::complex<T> >& out
+            )
+            /*!
+                ensures
+                    - appends the 7*2^p twiddle factors R8TX needs when nxtlt == 2^p to out.
+            !*/
+            {
+                const int nxtlt = 0x1 << p;
+                out.reserve(out.size() + nxtlt*7);
+                const T twopi = 6.2831853071795865; /* 2.0 * pi */
+                const T scale = twopi/(nxtlt*8.0);
+                std::complex<T> cs[7];
+                for (int j = 0; j < nxtlt; ++j)
+                {
+                    const T arg = j*scale;
+                    cs[0] = std::complex<T>(std::cos(arg),std::sin(arg));
+                    cs[1] = cs[0]*cs[0];
+                    cs[2] = cs[1]*cs[0];
+                    cs[3] = cs[1]*cs[1];
+                    cs[4] = cs[2]*cs[1];
+                    cs[5] = cs[2]*cs[2];
+                    cs[6] = cs[3]*cs[2];
+                    out.insert(out.end(), cs, cs+7);
+                }
+            }
+
         private:
             std::vector<std::vector<std::complex<T> > > data;
         };
 
+    // ----------------------------------------------------------------------------------------
+
+        template <typename T>
+        twiddles<T>& thread_twiddles (
+        )
+        /*!
+            ensures
+                - returns the twiddle cache of the calling thread.  Reusing it means the
+                  twiddles are only computed once per size, and repeated transforms of the
+                  same size don't allocate anything.
+        !*/
+        {
+            thread_local twiddles<T> cs;
+            return cs;
+        }
+
     // ----------------------------------------------------------------------------------------
 
         /* Radix-8 iteration subroutine */
@@ -221,51 +252,33 @@ namespace dlib
 
     // ------------------------------------------------------------------------------------
 
-        template <typename T, long NR, long NC, typename MM, typename layout>
-        void fft1d_inplace(matrix<std::complex<T>,NR,NC,MM,layout>& data, bool do_backward_fft, twiddles<T>& cs)
+        template <typename T, typename twiddle_source>
+        void fft1d_butterflies(std::complex<T>* b, int n2pow, twiddle_source& cs)
         /*!
             requires
-                - is_vector(data) == true
-                - is_power_of_two(data.size()) == true
+                - b points to 2^n2pow elements
+                - cs.get_twiddles(p) returns the R8TX twiddles for nxtlt == 2^p
             ensures
-                - This routine replaces the input std::complex<double> vector by its finite
-                  discrete complex fourier transform if do_backward_fft==true.  It replaces
-                  the input std::complex<double> vector by its finite discrete complex
-                  inverse fourier transform if do_backward_fft==false.
+                - Runs the butterfly passes of the transform over b.  The outputs are
+                  left in bit reversed order, see bit_reverse_permute().
 
                   The implementation is a radix-2 FFT, but with faster shortcuts for
                   radix-4 and radix-8. It performs as many radix-8 iterations as possible,
                   and then finishes with a radix-2 or -4 iteration if needed.
         !*/
         {
-            COMPILE_TIME_ASSERT((is_same_type<double,T>::value || is_same_type<float,T>::value || is_same_type<long double,T>::value ));
-
-            if (data.size() == 0)
-                return;
+            const int nthpo = 0x1 << n2pow;
+            const int n8pow = n2pow/3;
 
-            std::complex<T>* const b = &data(0);
-            int L[16],L1,L2,L3,L4,L5,L6,L7,L8,L9,L10,L11,L12,L13,L14,L15;
-            int j1,j2,j3,j4,j5,j6,j7,j8,j9,j10,j11,j12,j13,j14;
-            int j, ij, ji;
-            int n2pow, n8pow, nthpo, ipass, nxtlt, length;
-
-            n2pow = fastlog2(data.size());
-            nthpo = data.size();
-
-            n8pow = n2pow/3;
-
-            if(n8pow)
+            /* Radix 8 iterations */
+            for(int ipass=1;ipass<=n8pow;ipass++) 
             {
-                /* Radix 8 iterations */
-                for(ipass=1;ipass<=n8pow;ipass++) 
-                {
-                    const int p = n2pow - 3*ipass;
-                    nxtlt = 0x1 << p;
-                    length = 8*nxtlt;
-                    R8TX(nxtlt, nthpo, length, cs.get_twiddles(p),
-                        b, b+nxtlt, b+2*nxtlt, b+3*nxtlt,
-                        b+4*nxtlt, b+5*nxtlt, b+6*nxtlt, b+7*nxtlt);
-                }
+                const int p = n2pow - 3*ipass;
+                const int nxtlt = 0x1 << p;
+                const int length = 8*nxtlt;
+                R8TX(nxtlt, nthpo, length, cs.get_twiddles(p),
+                    b, b+nxtlt, b+2*nxtlt, b+3*nxtlt,
+                    b+4*nxtlt, b+5*nxtlt, b+6*nxtlt, b+7*nxtlt);
             }
 
             if(n2pow%3 == 1) 
@@ -279,6 +292,22 @@ namespace dlib
                 /* A final radix 4 iteration is needed */
                 R4TX(nthpo, b, b+1, b+2, b+3); 
             }
+        }
+
+    // ------------------------------------------------------------------------------------
+
+        template <typename U>
+        void bit_reverse_permute(U* b, int n2pow)
+        /*!
+            requires
+                - b points to 2^n2pow elements
+            ensures
+                - puts the outputs of fft1d_butterflies() back in natural order.
+        !*/
+        {
+            int L[16],L1,L2,L3,L4,L5,L6,L7,L8,L9,L10,L11,L12,L13,L14,L15;
+            int j1,j2,j3,j4,j5,j6,j7,j8,j9,j10,j11,j12,j13,j14;
+            int j, ij, ji;
 
             for(j=1;j<=15;j++) 
             {
@@ -311,7 +340,33 @@ namespace dlib
                                                                             swap(b[ij], b[ji]);
                                                                         ij++;
                                                                     }
+        }
 
+    // ------------------------------------------------------------------------------------
+
+        template <typename T, long NR, long NC, typename MM, typename layout>
+        void fft1d_inplace(matrix<std::complex<T>,NR,NC,MM,layout>& data, bool do_backward_fft, twiddles<T>& cs)
+        /*!
+            requires
+                - is_vector(data) == true
+                - is_power_of_two(data.size()) == true
+            ensures
+                - This routine replaces the input std::complex<double> vector by its finite
+                  discrete complex fourier transform if do_backward_fft==true.  It replaces
+                  the input std::complex<double> vector by its finite discrete complex
+                  inverse fourier transform if do_backward_fft==false.
+        !*/
+        {
+            COMPILE_TIME_ASSERT((is_same_type<double,T>::value || is_same_type<float,T>::value || is_same_type<long double,T>::value ));
+
+            if (data.size() == 0)
+                return;
+
+            std::complex<T>* const b = &data(0);
+            const int n2pow = fastlog2(data.size());
+
+            fft1d_butterflies(b, n2pow, cs);
+            bit_reverse_permute(b, n2pow);
 
             // unscramble outputs
             if(!do_backward_fft) 
@@ -334,23 +389,26 @@ namespace dlib
             if (data.size() == 0)
                 return;
 
-            matrix<std::complex<double> > buff;
-            twiddles<double> cs;
+            // Work in the precision of the data, like the 1D transforms do.  Rows and
+            // columns get their own buffers so neither is resized between the passes.
+            thread_local matrix<std::complex<T>,1,0> row_buff;
+            thread_local matrix<std::complex<T>,0,1> col_buff;
+            twiddles<T>& cs = thread_twiddles<T>();
 
             // Compute transform row by row
             for(long r=0; r<data.nr(); ++r) 
             {
-                buff = matrix_cast<std::complex<double> >(rowm(data,r));
-                fft1d_inplace(buff, do_backward_fft, cs);
-                set_rowm(data,r) = matrix_cast<std::complex<T> >(buff);
+                row_buff = rowm(data,r);
+                fft1d_inplace(row_buff, do_backward_fft, cs);
+                set_rowm(data,r) = row_buff;
             }
 
             // Compute transform column by column
             for(long c=0; c<data.nc(); ++c) 
             {
-                buff = matrix_cast<std::complex<double> >(colm(data,c));
-                fft1d_inplace(buff, do_backward_fft, cs);
-                set_colm(data,c) = matrix_cast<std::complex<T> >(buff);
+                col_buff = colm(data,c);
+                fft1d_inplace(col_buff, do_backward_fft, cs);
+                set_colm(data,c) = col_buff;
             }
         }
         
@@ -379,27 +437,122 @@ namespace dlib
             if (data.size() == 0)
                 return;
 
-            matrix<std::complex<double> > buff;
+            thread_local matrix<std::complex<T>,1,0> row_buff;
+            thread_local matrix<std::complex<T>,0,1> col_buff;
             data_out.set_size(data.nr(), data.nc());
-            twiddles<double> cs;
+            twiddles<T>& cs = thread_twiddles<T>();
 
             // Compute transform row by row
             for(long r=0; r<data.nr(); ++r) 
             {
-                buff = matrix_cast<std::complex<double> >(rowm(data,r));
-                fft1d_inplace(buff, do_backward_fft, cs);
-                set_rowm(data_out,r) = matrix_cast<std::complex<T> >(buff);
+                row_buff = matrix_cast<std::complex<T> >(rowm(data,r));
+                fft1d_inplace(row_buff, do_backward_fft, cs);
+                set_rowm(data_out,r) = row_buff;
             }
 
             // Compute transform column by column
             for(long c=0; c<data_out.nc(); ++c) 
             {
-                buff = matrix_cast<std::complex<double> >(colm(data_out,c));
-                fft1d_inplace(buff, do_backward_fft, cs);
-                set_colm(data_out,c) = matrix_cast<std::complex<T> >(buff);
+                col_buff = colm(data_out,c);
+                fft1d_inplace(col_buff, do_backward_fft, cs);
+                set_colm(data_out,c) = col_buff;
             }
         }
         
+    // ------------------------------------------------------------------------------------
+
+        template <typename T>
+        class fft_line_plan
+        {
+            /*!
+                WHAT THIS OBJECT REPRESENTS
+                    This object holds everything fft1d_inplace() works out on each call for
+                    a transform of a given length: the twiddles of every radix 8 pass and
+                    the order the butterflies leave the outputs in.  Once set up it is
+                    never modified, so any number of threads can run it at once.
+            !*/
+        public:
+
+            fft_line_plan() : n(0), n2pow(0) {}
+
+            void setup (
+                long length
+            )
+            /*!
+                requires
+                    - is_power_of_two(length) == true
+            !*/
+            {
+                n = length;
+                n2pow = (n == 0) ? 0 : fastlog2(n);
+                table.clear();
+                offsets.clear();
+                for (int ipass = 1; ipass <= n2pow/3; ++ipass)
+                {
+                    offsets.push_back(table.size());
+                    twiddles<T>::append_twiddles(n2pow - 3*ipass, table);
+                }
+
+                backward_order.resize(n);
+                forward_order.resize(n);
+                for (long i = 0; i < n; ++i)
+                    backward_order[i] = i;
+                if (n != 0)
+                    bit_reverse_permute(&backward_order[0], n2pow);
+                // The forward transform also unscrambles the outputs, i.e. reverses all
+                // but the first element.
+                for (long i = 0; i < n; ++i)
+                    forward_order[i] = backward_order[(n-i)%n];
+            }
+
+            long size (
+            ) const { return n; }
+
+            const std::complex<T>* get_twiddles (
+                int p
+            ) const
+            {
+                return &table[offsets[(n2pow - p)/3 - 1]];
+            }
+
+            void butterflies (
+                std::complex<T>* b
+            ) const
+            /*!
+                ensures
+                    - runs the butterfly passes over the size() elements of b in place
+            !*/
+            {
+                fft1d_butterflies(b, n2pow, *this);
+            }
+
+            void gather (
+                const std::complex<T>* b,
+                std::complex<T>* out,
+                long stride,
+                bool do_backward_fft
+            ) const
+            /*!
+                requires
+                    - b holds the output of butterflies()
+                    - b and out don't overlap
+                ensures
+                    - #out[i*stride] == the i-th output of the transform, for i < size()
+            !*/
+            {
+                const long* order = do_backward_fft ? &backward_order[0] : &forward_order[0];
+                for (long i = 0; i < n; ++i)
+                    out[i*stride] = b[order[i]];
+            }
+
+        private:
+            long n;
+            int n2pow;
+            std::vector<std::complex<T> > table;
+            std::vector<size_t> offsets;
+            std::vector<long> forward_order, backward_order;
+        };
+
     // ------------------------------------------------------------------------------------
 
     } // end namespace impl
@@ -424,7 +577,7 @@ namespace dlib
         if (data.nr() == 1 || data.nc() == 1)
         {
             matrix<typename EXP::type> temp(data);
-            impl::twiddles<typename EXP::type::value_type> cs;
+            impl::twiddles<typename EXP::type::value_type>& cs = impl::thread_twiddles<typename EXP::type::value_type>();
             impl::fft1d_inplace(temp, false, cs);
             return temp;
         }
@@ -458,7 +611,7 @@ namespace dlib
         if (data.nr() == 1 || data.nc() == 1)
         {
             temp = data;
-            impl::twiddles<typename EXP::type::value_type> cs;
+            impl::twiddles<typename EXP::type::value_type>& cs = impl::thread_twiddles<typename EXP::type::value_type>();
             impl::fft1d_inplace(temp, true, cs);
         }
         else
@@ -485,7 +638,7 @@ namespace dlib
             << "\n\t is_power_of_two(data.nc()): " << is_power_of_two(data.nc())
             );
 
-        impl::twiddles<T> cs;
+        impl::twiddles<T>& cs = impl::thread_twiddles<T>();
         impl::fft1d_inplace(data, false, cs);
     }
 
@@ -521,7 +674,7 @@ namespace dlib
             << "\n\t is_power_of_two(data.nc()): " << is_power_of_two(data.nc())
             );
 
-        impl::twiddles<T> cs;
+        impl::twiddles<T>& cs = impl::thread_twiddles<T>();
         impl::fft1d_inplace(data, true, cs);
     }
 
@@ -541,6 +694,481 @@ namespace dlib
         impl::fft2d_inplace(data, true);
     }
 
+// ----------------------------------------------------------------------------------------
+
+    template <typename T>
+    class fft_plan
+    {
+    public:
+        typedef std::complex<T> complex_type;
+
+        fft_plan (
+        ) : rows(0), cols(0) {}
+
+        fft_plan (
+            long nr,
+            long nc
+        ) : rows(nr), cols(nc)
+        {
+            COMPILE_TIME_ASSERT((is_same_type<double,T>::value || is_same_type<float,T>::value || is_same_type<long double,T>::value ));
+            DLIB_CASSERT(nr >= 0 && nc >= 0 && is_power_of_two(nr) && is_power_of_two(nc),
+                "\t fft_plan::fft_plan(nr,nc)"
+                << "\n\t The number of rows and columns must be powers of two."
+                << "\n\t nr: "<< nr
+                << "\n\t nc: "<< nc
+            );
+
+            if (size() == 0)
+                return;
+
+            // A vector is a single line, anything else is transformed row by row and
+            // then column by column.
+            const long line = is_vector() ? size() : nc;
+            row_plan.setup(line);
+            col_plan.setup(is_vector() ? 0 : nr);
+
+            // Real lines of length line are done as complex lines half as long.
+            half_plan.setup(line/2);
+            split_twiddles.resize(line/2+1);
+            for (long k = 0; k <= line/2; ++k)
+            {
+                const double arg = -2*pi*k/line;
+                split_twiddles[k] = complex_type((T)std::cos(arg), (T)std::sin(arg));
+            }
+        }
+
+        long nr (
+        ) const { return rows; }
+
+        long nc (
+        ) const { return cols; }
+
+        long size (
+        ) const { return rows*cols; }
+
+        // Size of the half spectra of forward_half() and backward_half()
+        long half_nr (
+        ) const { return (cols == 1 && rows > 1) ? rows/2+1 : rows; }
+
+        long half_nc (
+        ) const { return (cols == 1 && rows > 1) ? 1 : cols/2+1; }
+
+        void forward (
+            complex_type* data
+        ) const { transform(data, false); }
+
+        void backward (
+            complex_type* data
+        ) const { transform(data, true); }
+
+        void forward_real (
+            const T* data,
+            complex_type* out
+        ) const
+        {
+            if (size() == 0)
+                return;
+
+            if (is_vector())
+            {
+                const long n = size();
+                real_line(data, out);
+                for (long k = n/2+1; k < n; ++k)
+                    out[k] = std::conj(out[n-k]);
+                return;
+            }
+
+            // The last nc/2-1 columns of the spectrum are the mirror images of the others.
+            const long half = cols/2+1;
+            real_columns(data, out, cols);
+            for (long r = 0; r < rows; ++r)
+            {
+                const long mr = (rows-r)%rows;
+                for (long c = half; c < cols; ++c)
+                    out[r*cols + c] = std::conj(out[mr*cols + cols-c]);
+            }
+        }
+
+        void forward_half (
+            const T* data,
+            complex_type* out
+        ) const
+        {
+            if (size() == 0)
+                return;
+
+            if (is_vector())
+                real_line(data, out);
+            else
+                real_columns(data, out, cols/2+1);
+        }
+
+        void backward_half (
+            const complex_type* data,
+            T* out
+        ) const
+        {
+            if (size() == 0)
+                return;
+
+            if (is_vector())
+            {
+                real_inverse_line(data, out);
+                return;
+            }
+
+            // The columns first this time, so the rows end up as half spectra of real
+            // lines.
+            const long half = cols/2+1;
+            std::vector<complex_type>& trans = scratch(2, half*rows);
+            std::vector<complex_type>& spectra = scratch(3, half*rows);
+            for (long r = 0; r < rows; ++r)
+            {
+                for (long c = 0; c < half; ++c)
+                    trans[c*rows + r] = data[r*half + c];
+            }
+            for (long c = 0; c < half; ++c)
+            {
+                col_plan.butterflies(&trans[c*rows]);
+                col_plan.gather(&trans[c*rows], &spectra[c], half, true);
+            }
+            for (long r = 0; r < rows; ++r)
+                real_inverse_line(&spectra[r*half], out + r*cols);
+        }
+
+        template <long NR, long NC, typename MM>
+        void forward (
+            matrix<complex_type,NR,NC,MM,row_major_layout>& data
+        ) const
+        {
+            DLIB_ASSERT(data.nr() == nr() && data.nc() == nc(),
+                "\t void fft_plan::forward(data)"
+                << "\n\t The matrix doesn't have the size of the plan."
+                << "\n\t data.nr(): "<< data.nr()
+                << "\n\t data.nc(): "<< data.nc()
+                << "\n\t nr(): "<< nr()
+                << "\n\t nc(): "<< nc()
+            );
+            if (data.size() != 0)
+                forward(&data(0,0));
+        }
+
+        template <long NR, long NC, typename MM>
+        void backward (
+            matrix<complex_type,NR,NC,MM,row_major_layout>& data
+        ) const
+        {
+            DLIB_ASSERT(data.nr() == nr() && data.nc() == nc(),
+                "\t void fft_plan::backward(data)"
+                << "\n\t The matrix doesn't have the size of the plan."
+                << "\n\t data.nr(): "<< data.nr()
+                << "\n\t data.nc(): "<< data.nc()
+                << "\n\t nr(): "<< nr()
+                << "\n\t nc(): "<< nc()
+            );
+            if (data.size() != 0)
+                backward(&data(0,0));
+        }
+
+        template <long NR1, long NC1, typename MM1, long NR2, long NC2, typename MM2>
+        void forward_real (
+            const matrix<T,NR1,NC1,MM1,row_major_layout>& data,
+            matrix<complex_type,NR2,NC2,MM2,row_major_layout>& out
+        ) const
+        {
+            DLIB_ASSERT(data.nr() == nr() && data.nc() == nc(),
+                "\t void fft_plan::forward_real(data,out)"
+                << "\n\t The matrix doesn't have the size of the plan."
+                << "\n\t data.nr(): "<< data.nr()
+                << "\n\t data.nc(): "<< data.nc()
+                << "\n\t nr(): "<< nr()
+                << "\n\t nc(): "<< nc()
+            );
+            out.set_size(data.nr(), data.nc());
+            if (data.size() != 0)
+                forward_real(&data(0,0), &out(0,0));
+        }
+
+        template <long NR1, long NC1, typename MM1, long NR2, long NC2, typename MM2>
+        void forward_half (
+            const matrix<T,NR1,NC1,MM1,row_major_layout>& data,
+            matrix<complex_type,NR2,NC2,MM2,row_major_layout>& out
+        ) const
+        {
+            DLIB_ASSERT(data.nr() == nr() && data.nc() == nc(),
+                "\t void fft_plan::forward_half(data,out)"
+                << "\n\t The matrix doesn't have the size of the plan."
+                << "\n\t data.nr(): "<< data.nr()
+                << "\n\t data.nc(): "<< data.nc()
+                << "\n\t nr(): "<< nr()
+                << "\n\t nc(): "<< nc()
+            );
+            out.set_size(half_nr(), half_nc());
+            if (data.size() != 0)
+                forward_half(&data(0,0), &out(0,0));
+        }
+
+        template <long NR1, long NC1, typename MM1, long NR2, long NC2, typename MM2>
+        void backward_half (
+            const matrix<complex_type,NR1,NC1,MM1,row_major_layout>& data,
+            matrix<T,NR2,NC2,MM2,row_major_layout>& out
+        ) const
+        {
+            DLIB_ASSERT(data.nr() == half_nr() && data.nc() == half_nc(),
+                "\t void fft_plan::backward_half(data,out)"
+                << "\n\t The matrix doesn't have the size of the plan's half spectra."
+                << "\n\t data.nr(): "<< data.nr()
+                << "\n\t data.nc(): "<< data.nc()
+                << "\n\t half_nr(): "<< half_nr()
+                << "\n\t half_nc(): "<< half_nc()
+            );
+            out.set_size(nr(), nc());
+            if (out.size() != 0)
+                backward_half(&data(0,0), &out(0,0));
+        }
+
+    private:
+
+        bool is_vector (
+        ) const { return rows == 1 || cols == 1; }
+
+        static std::vector<complex_type>& scratch (
+            int which,
+            size_t size
+        )
+        {
+            // Plans are shared between threads, so the buffers belong to the threads.
+            thread_local std::vector<complex_type> buffers[4];
+            if (buffers[which].size() < size)
+                buffers[which].resize(size);
+            return buffers[which];
+        }
+
+        void transform (
+            complex_type* data,
+            bool do_backward_fft
+        ) const
+        {
+            if (size() == 0)
+                return;
+
+            std::vector<complex_type>& line = scratch(0, std::max(rows, cols));
+            if (is_vector())
+            {
+                std::copy(data, data + size(), line.begin());
+                row_plan.butterflies(&line[0]);
+                row_plan.gather(&line[0], data, 1, do_backward_fft);
+                return;
+            }
+
+            // Rows first, writing them out transposed, then the columns, which the
+            // transposition made contiguous, back into place.
+            std::vector<complex_type>& trans = scratch(2, size());
+            for (long r = 0; r < rows; ++r)
+            {
+                std::copy(data + r*cols, data + (r+1)*cols, line.begin());
+                row_plan.butterflies(&line[0]);
+                row_plan.gather(&line[0], &trans[r], rows, do_backward_fft);
+            }
+            for (long c = 0; c < cols; ++c)
+            {
+                col_plan.butterflies(&trans[c*rows]);
+                col_plan.gather(&trans[c*rows], data + c, cols, do_backward_fft);
+            }
+        }
+
+        void real_columns (
+            const T* data,
+            complex_type* out,
+            long stride
+        ) const
+        /*!
+            ensures
+                - writes the first nc/2+1 columns of the spectrum of the real matrix at
+                  data to out, whose rows are stride elements apart.
+        !*/
+        {
+            // The rows go into a transposed buffer so the column passes run over
+            // contiguous memory.
+            const long half = cols/2+1;
+            std::vector<complex_type>& line = scratch(0, half);
+            std::vector<complex_type>& trans = scratch(2, half*rows);
+            for (long r = 0; r < rows; ++r)
+            {
+                real_line(data + r*cols, &line[0]);
+                for (long c = 0; c < half; ++c)
+                    trans[c*rows + r] = line[c];
+            }
+            for (long c = 0; c < half; ++c)
+            {
+                col_plan.butterflies(&trans[c*rows]);
+                col_plan.gather(&trans[c*rows], out + c, stride, false);
+            }
+        }
+
+        void real_line (
+            const T* x,
+            complex_type* out
+        ) const
+        /*!
+            ensures
+                - writes the first row_plan.size()/2+1 outputs of the forward transform of
+                  the real line x to out.  The even and odd samples are packed into one
+                  complex line of half the length, whose transform is then split into
+                  the transforms of both halves and combined.
+        !*/
+        {
+            const long n = row_plan.size();
+            if (n == 1)
+            {
+                out[0] = x[0];
+                return;
+            }
+
+            const long m = n/2;
+            std::vector<complex_type>& packed = scratch(1, m);
+            for (long i = 0; i < m; ++i)
+                packed[i] = complex_type(x[2*i], x[2*i+1]);
+            half_plan.butterflies(&packed[0]);
+            // out has room for m+1 values, so the half length transform fits too.
+            half_plan.gather(&packed[0], out, 1, false);
+
+            const complex_type z0 = out[0];
+            for (long k = 0, j = m; k <= j; ++k, --j)
+            {
+                const complex_type zk = (k == m) ? z0 : out[k];
+                const complex_type zj = (j == m) ? z0 : out[j];
+                const complex_type ek = (zk + std::conj(zj))*(T)0.5;
+                const complex_type ok = (zk - std::conj(zj))*complex_type(0,(T)-0.5);
+                const complex_type ej = std::conj(ek);
+                const complex_type oj = std::conj(ok);
+                out[k] = ek + split_twiddles[k]*ok;
+                out[j] = ej + split_twiddles[j]*oj;
+            }
+        }
+
+        void real_inverse_line (
+            const complex_type* in,
+            T* x
+        ) const
+        /*!
+            ensures
+                - writes the backward transform of the real line whose first
+                  row_plan.size()/2+1 outputs are in to x.  This undoes real_line(): the
+                  transforms of the even and odd samples are recovered and packed into one
+                  complex line of half the length.
+        !*/
+        {
+            const long n = row_plan.size();
+            if (n == 1)
+            {
+                x[0] = in[0].real();
+                return;
+            }
+
+            const long m = n/2;
+            std::vector<complex_type>& packed = scratch(1, m);
+            std::vector<complex_type>& line = scratch(0, m);
+            for (long k = 0; k < m; ++k)
+            {
+                const complex_type xk = in[k];
+                const complex_type xj = std::conj(in[m-k]);
+                packed[k] = (xk + xj) + complex_type(0,1)*(xk - xj)*std::conj(split_twiddles[k]);
+            }
+            half_plan.butterflies(&packed[0]);
+            half_plan.gather(&packed[0], &line[0], 1, true);
+            for (long i = 0; i < m; ++i)
+            {
+                x[2*i] = line[i].real();
+                x[2*i+1] = line[i].imag();
+            }
+        }
+
+        long rows;
+        long cols;
+        impl::fft_line_plan<T> row_plan;
+        impl::fft_line_plan<T> col_plan;
+        impl::fft_line_plan<T> half_plan;
+        std::vector<complex_type> split_twiddles;
+    };
+
+// ----------------------------------------------------------------------------------------
+
+    template <typename T>
+    const fft_plan<T>& get_fft_plan (
+        long nr,
+        long nc
+    )
+    {
+        static std::mutex m;
+        static std::map<std::pair<long,long>, std::unique_ptr<fft_plan<T> > > plans;
+
+        std::lock_guard<std::mutex> lock(m);
+        std::unique_ptr<fft_plan<T> >& plan = plans[std::make_pair(nr,nc)];
+        if (!plan)
+            plan.reset(new fft_plan<T>(nr,nc));
+        return *plan;
+    }
+
+    template <typename T, long NR, long NC>
+    const fft_plan<T>& get_fft_plan (
+    )
+    {
+        // Looked up once, later calls don't touch the lock.
+        static const fft_plan<T>& plan = get_fft_plan<T>(NR,NC);
+        return plan;
+    }
+
+// ----------------------------------------------------------------------------------------
+
+    template <typename EXP>
+    matrix<std::complex<typename EXP::type> > rfft (const matrix_exp<EXP>& data)
+    {
+        typedef typename EXP::type T;
+        // You have to give a real matrix
+        COMPILE_TIME_ASSERT((is_same_type<double,T>::value || is_same_type<float,T>::value || is_same_type<long double,T>::value ));
+        // make sure requires clause is not broken
+        DLIB_CASSERT(is_power_of_two(data.nr()) && is_power_of_two(data.nc()),
+            "\t matrix rfft(data)"
+            << "\n\t The number of rows and columns must be powers of two."
+            << "\n\t data.nr(): "<< data.nr()
+            << "\n\t data.nc(): "<< data.nc()
+            << "\n\t is_power_of_two(data.nr()): " << is_power_of_two(data.nr())
+            << "\n\t is_power_of_two(data.nc()): " << is_power_of_two(data.nc())
+            );
+
+        const matrix<T> temp(data);
+        matrix<std::complex<T> > out;
+        get_fft_plan<T>(data.nr(), data.nc()).forward_half(temp, out);
+        return out;
+    }
+
+    template <typename EXP>
+    matrix<typename EXP::type::value_type> irfft (const matrix_exp<EXP>& data)
+    {
+        typedef typename EXP::type::value_type T;
+        // You have to give a complex matrix
+        COMPILE_TIME_ASSERT(is_complex<typename EXP::type>::value);
+
+        // Vectors are halved along their length, anything else along its rows.
+        const bool column_vector = data.nc() == 1 && data.nr() > 1;
+        const long nr = column_vector ? 2*(data.nr()-1) : data.nr();
+        const long nc = column_vector ? 1 : 2*(data.nc()-1);
+        // make sure requires clause is not broken
+        DLIB_CASSERT(data.size() > 1 && is_power_of_two(nr) && is_power_of_two(nc),
+            "\t matrix irfft(data)"
+            << "\n\t data isn't the half spectrum of a matrix whose dimensions are powers of two."
+            << "\n\t data.nr(): "<< data.nr()
+            << "\n\t data.nc(): "<< data.nc()
+            );
+
+        const matrix<std::complex<T> > temp(data);
+        matrix<T> out;
+        get_fft_plan<T>(nr, nc).backward_half(temp, out);
+        out /= out.size();
+        return out;
+    }
+
 // ----------------------------------------------------------------------------------------
 
     /*
@@ -110,6 +110,289 @@ namespace dlib
                   inverse transformation.  
     !*/
 
+// ----------------------------------------------------------------------------------------
+
+    template <
+        typename T
+        >
+    class fft_plan
+    {
+        /*!
+            REQUIREMENTS ON T
+                T is double, float, or long double.
+
+            WHAT THIS OBJECT REPRESENTS
+                This object is a precomputed FFT of a fixed size.  It holds the twiddle
+                factors and output orderings that fft_inplace() works out on every call,
+                so code that transforms many matrices of the same size only pays for them
+                once.  It also has paths for real valued inputs that do about half the
+                work of transforming them as complex matrices.  The spectrum of a real
+                matrix is conjugate symmetric, so forward_half() and backward_half() only
+                store the half of it that isn't redundant, see half_nr() and half_nc().
+
+                The transforms give the same results as fft_inplace() and ifft_inplace(),
+                and they don't allocate memory once a thread has done one of them.
+
+            THREAD SAFETY
+                A plan is never modified after construction, so any number of threads can
+                use the same plan at once.
+        !*/
+    public:
+
+        typedef std::complex<T> complex_type;
+
+        fft_plan (
+        );
+        /*!
+            ensures
+                - #nr() == 0
+                - #nc() == 0
+        !*/
+
+        fft_plan (
+            long nr,
+            long nc
+        );
+        /*!
+            requires
+                - is_power_of_two(nr) == true
+                - is_power_of_two(nc) == true
+            ensures
+                - #nr() == nr
+                - #nc() == nc
+        !*/
+
+        long nr (
+        ) const;
+        /*!
+            ensures
+                - returns the number of rows of the matrices this plan transforms
+        !*/
+
+        long nc (
+        ) const;
+        /*!
+            ensures
+                - returns the number of columns of the matrices this plan transforms
+        !*/
+
+        long size (
+        ) const;
+        /*!
+            ensures
+                - returns nr()*nc()
+        !*/
+
+        long half_nr (
+        ) const;
+        /*!
+            ensures
+                - returns the number of rows of the half spectra of forward_half().  That
+                  is, nr()/2+1 for column vectors and nr() for anything else.
+        !*/
+
+        long half_nc (
+        ) const;
+        /*!
+            ensures
+                - returns the number of columns of the half spectra of forward_half().
+                  That is, 1 for column vectors and nc()/2+1 for anything else.
+        !*/
+
+        void forward (
+            complex_type* data
+        ) const;
+        /*!
+            requires
+                - data points to a row major nr() by nc() matrix
+            ensures
+                - performs fft_inplace() on the matrix at data.
+        !*/
+
+        void backward (
+            complex_type* data
+        ) const;
+        /*!
+            requires
+                - data points to a row major nr() by nc() matrix
+            ensures
+                - performs ifft_inplace() on the matrix at data.  So as with
+                  ifft_inplace(), the outputs are not divided by size().
+        !*/
+
+        void forward_real (
+            const T* data,
+            complex_type* out
+        ) const;
+        /*!
+            requires
+                - data and out point to row major nr() by nc() matrices
+            ensures
+                - #out == the fft() of the real matrix at data.
+        !*/
+
+        void forward_half (
+            const T* data,
+            complex_type* out
+        ) const;
+        /*!
+            requires
+                - data points to a row major nr() by nc() matrix
+                - out points to a row major half_nr() by half_nc() matrix
+            ensures
+                - #out == the first half_nr() rows and half_nc() columns of the fft() of
+                  the real matrix at data.  The rest of the spectrum can be recovered from
+                  them since it is conjugate symmetric.
+        !*/
+
+        void backward_half (
+            const complex_type* data,
+            T* out
+        ) const;
+        /*!
+            requires
+                - data points to a row major half_nr() by half_nc() matrix holding the
+                  half spectrum of a real matrix, as made by forward_half().
+                - out points to a row major nr() by nc() matrix
+            ensures
+                - #out == the real matrix whose half spectrum is at data, times size().
+                  That is, this function undoes forward_half() except that, as with
+                  ifft_inplace(), the outputs are not divided by size().
+        !*/
+
+        template <long NR, long NC, typename MM>
+        void forward (
+            matrix<complex_type,NR,NC,MM,row_major_layout>& data
+        ) const;
+        /*!
+            requires
+                - data.nr() == nr()
+                - data.nc() == nc()
+            ensures
+                - #data == fft(data)
+        !*/
+
+        template <long NR, long NC, typename MM>
+        void backward (
+            matrix<complex_type,NR,NC,MM,row_major_layout>& data
+        ) const;
+        /*!
+            requires
+                - data.nr() == nr()
+                - data.nc() == nc()
+            ensures
+                - #data == ifft(data)*data.size()
+        !*/
+
+        template <long NR1, long NC1, typename MM1, long NR2, long NC2, typename MM2>
+        void forward_real (
+            const matrix<T,NR1,NC1,MM1,row_major_layout>& data,
+            matrix<complex_type,NR2,NC2,MM2,row_major_layout>& out
+        ) const;
+        /*!
+            requires
+                - data.nr() == nr()
+                - data.nc() == nc()
+            ensures
+                - #out == fft(matrix_cast<complex_type>(data))
+        !*/
+
+        template <long NR1, long NC1, typename MM1, long NR2, long NC2, typename MM2>
+        void forward_half (
+            const matrix<T,NR1,NC1,MM1,row_major_layout>& data,
+            matrix<complex_type,NR2,NC2,MM2,row_major_layout>& out
+        ) const;
+        /*!
+            requires
+                - data.nr() == nr()
+                - data.nc() == nc()
+            ensures
+                - #out == rfft(data)
+        !*/
+
+        template <long NR1, long NC1, typename MM1, long NR2, long NC2, typename MM2>
+        void backward_half (
+            const matrix<complex_type,NR1,NC1,MM1,row_major_layout>& data,
+            matrix<T,NR2,NC2,MM2,row_major_layout>& out
+        ) const;
+        /*!
+            requires
+                - data.nr() == half_nr()
+                - data.nc() == half_nc()
+            ensures
+                - #out == irfft(data)*size()
+        !*/
+    };
+
+// ----------------------------------------------------------------------------------------
+
+    template <typename T>
+    const fft_plan<T>& get_fft_plan (
+        long nr,
+        long nc
+    );
+    /*!
+        requires
+            - is_power_of_two(nr) == true
+            - is_power_of_two(nc) == true
+        ensures
+            - returns a plan for nr by nc transforms.  The plan is made the first time a
+              size is asked for and then shared by all callers, and it lives until the
+              program ends.
+            - This function is threadsafe.
+    !*/
+
+    template <typename T, long NR, long NC>
+    const fft_plan<T>& get_fft_plan (
+    );
+    /*!
+        ensures
+            - returns get_fft_plan<T>(NR,NC).  The plan of a size known at compile time
+              is looked up once, so calling this function is essentially free.
+    !*/
+
+// ----------------------------------------------------------------------------------------
+
+    template <typename EXP>
+    matrix<std::complex<typename EXP::type> > rfft (
+        const matrix_exp<EXP>& data
+    );
+    /*!
+        requires
+            - data contains elements of type double, float, or long double.
+            - is_power_of_two(data.nr()) == true
+            - is_power_of_two(data.nc()) == true
+        ensures
+            - Computes the discrete Fourier transform of the real matrix data and returns
+              the half of it that isn't redundant.  Since data is real, fft(data) is
+              conjugate symmetric and all of it can be recovered from the returned matrix
+              D, which holds:
+                - if (data is a column vector with more than one element) then
+                    - D.nr() == data.nr()/2+1
+                    - D.nc() == 1
+                - else
+                    - D.nr() == data.nr()
+                    - D.nc() == data.nc()/2+1
+                - D(r,c) == fft(matrix_cast<std::complex<T> >(data))(r,c)
+    !*/
+
+    template <typename EXP>
+    matrix<typename EXP::type::value_type> irfft (
+        const matrix_exp<EXP>& data
+    );
+    /*!
+        requires
+            - data contains elements of type std::complex<> that itself contains double, float, or long double.
+            - data.size() > 1
+            - data is the output of rfft() for a matrix with more than one element.
+        ensures
+            - Computes the inverse of rfft().  That is, irfft(rfft(M)) == M
+            - if (data is a column vector) then
+                - returns a matrix with 2*(data.nr()-1) rows and 1 column
+            - else
+                - returns a matrix with data.nr() rows and 2*(data.nc()-1) columns
+    !*/
+
 // ----------------------------------------------------------------------------------------
 
 }
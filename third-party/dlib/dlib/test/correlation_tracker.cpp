@@ -35,6 +35,14 @@ namespace
         {
             dlog << LINFO << "perform_test()";
 
+            test_tracker<correlation_tracker>();
+            test_tracker<correlation_tracker_float>();
+        }
+
+        template <typename tracker_type>
+        void test_tracker (
+        )
+        {
             typedef const std::string(*frame_fn_type)();
             // frames from examples folder
             frame_fn_type frames[] = { &get_decoded_string_frame_000100,
@@ -51,17 +59,22 @@ namespace
             // correct update results - recorded by successful runs
             double correct_update_results[] = { 0, 18.3077, 16.8406, 13.1716 };
 
-            correlation_tracker tracker;
+            tracker_type tracker;
             std::istringstream sin(frames[0]());
             array2d<unsigned char> img;
             load_bmp(img, sin);
             tracker.start_track(img, centered_rect(point(93, 110), 38, 86));
+            // Runs the position and scale halves of update() separately
+            tracker_type split_tracker;
+            split_tracker.start_track(img, centered_rect(point(93, 110), 38, 86));
             for (unsigned i = 1; i < sizeof(frames) / sizeof(frames[0]); ++i)
             {
                 std::istringstream sin(frames[i]());
                 load_bmp(img, sin);
 
                 double res = tracker.update(img);
+                double split_res = split_tracker.update_noscale(img);
+                split_tracker.update_scale(img);
                 double correct_res = correct_update_results[i];
                 double res_diff = abs(correct_res - res);
 
@@ -78,6 +91,9 @@ namespace
                 // small error possible due to rounding and different optimization options
                 DLIB_TEST(res_diff <= 1);
                 DLIB_TEST(rect_confidence >= 0.97);
+                DLIB_TEST(split_res == res);
+                DLIB_TEST(length(split_tracker.get_position().tl_corner() - pos.tl_corner()) < 1e-9);
+                DLIB_TEST(length(split_tracker.get_position().br_corner() - pos.br_corner()) < 1e-9);
                 print_spinner();
             }
         }
@@ -154,6 +154,58 @@ namespace
         test_real_compile_time_sized_ffts<1,16>();
     }
 
+// ----------------------------------------------------------------------------------------
+
+    template <typename T>
+    void test_fft_plan(long nr, long nc)
+    {
+        const fft_plan<T>& plan = get_fft_plan<T>(nr,nc);
+        DLIB_TEST(&plan == &get_fft_plan<T>(nr,nc));
+        DLIB_TEST(plan.nr() == nr && plan.nc() == nc);
+
+        const T eps = is_same_type<T,double>::value ? 1e-16 : 1e-7;
+        const matrix<complex<T> > m1 = matrix_cast<complex<T> >(rand_complex(nr,nc));
+        const matrix<T> r1 = matrix_cast<T>(real(rand_complex(nr,nc)));
+
+        matrix<complex<T> > temp = m1;
+        plan.forward(temp);
+        DLIB_TEST(max(norm(temp-fft(m1))) < eps);
+        plan.backward(temp);
+        DLIB_TEST(max(norm(temp/temp.size()-m1)) < eps);
+
+        // The real input path rounds differently, so it is compared relative to the
+        // size of the spectrum.
+        const matrix<complex<T> > spectrum = fft(matrix_cast<complex<T> >(r1));
+        plan.forward_real(r1, temp);
+        DLIB_TEST(max(norm(temp-spectrum)) <= eps*max(norm(spectrum)));
+
+        const matrix<complex<T> > half = rfft(r1);
+        DLIB_TEST(half.nr() == plan.half_nr() && half.nc() == plan.half_nc());
+        DLIB_TEST(max(norm(half-subm(spectrum, 0, 0, half.nr(), half.nc()))) <= eps*max(norm(spectrum)));
+        if (r1.size() > 1)
+        {
+            const matrix<T> r2 = irfft(half);
+            DLIB_TEST(r2.nr() == nr && r2.nc() == nc);
+            DLIB_TEST(max(squared(r2-r1)) <= eps*max(squared(r1)));
+        }
+    }
+
+    void test_fft_plans()
+    {
+        for (int nr = 1; nr <= 128; nr*=2)
+        {
+            print_spinner();
+            for (int nc = 1; nc <= 128; nc *= 2)
+            {
+                test_fft_plan<double>(nr,nc);
+                test_fft_plan<float>(nr,nc);
+            }
+        }
+
+        const fft_plan<float>& plan = get_fft_plan<float,64,64>();
+        DLIB_TEST(&plan == &get_fft_plan<float>(64,64));
+    }
+
 // ----------------------------------------------------------------------------------------
 
     class test_fft : public tester
@@ -171,6 +223,7 @@ namespace
             test_against_saved_good_ffts();
             test_random_ffts();
             test_random_real_ffts();
+            test_fft_plans();
         }
     } a;
 